@@ -7,6 +7,7 @@ import android.database.DatabaseUtils;
 import android.database.sqlite.SQLiteCantOpenDatabaseException;
 import android.database.sqlite.SQLiteDatabase;
 import android.database.sqlite.SQLiteException;
+import com.telenav.ffmpeg.FFMPEG;
 import com.telenav.osv.item.LocalSequence;
 import com.telenav.osv.item.OSVFile;
 import com.telenav.osv.utils.Log;
@@ -391,6 +392,10 @@ public class SequenceDB {
         if (!video.delete()) {
             Log.w(TAG, "deleteVideo: delete unsuccessful: " + video.getName());
         }
+        OSVFile proxy = new OSVFile(FFMPEG.getProxyPath(video.getPath()));
+        if (proxy.exists() && !proxy.delete()) {
+            Log.w(TAG, "deleteVideo: delete unsuccessful: " + proxy.getName());
+        }
     }
 
     /**
@@ -32,6 +32,7 @@ import com.telenav.datacollectormodule.datatype.datatypes.GPSData;
 import com.telenav.datacollectormodule.datatype.datatypes.PositionObject;
 import com.telenav.datacollectormodule.datatype.datatypes.SpeedObject;
 import com.telenav.datacollectormodule.datatype.util.LibraryUtil;
+import com.telenav.ffmpeg.EncoderSession;
 import com.telenav.ffmpeg.FFMPEG;
 import com.telenav.osv.R;
 import com.telenav.osv.application.ApplicationPreferences;
@@ -152,6 +153,13 @@ public class Recorder implements ObdManager.ConnectionListener, LocationManager.
 
     private FFMPEG ffmpeg;
 
+    /**
+     * guarded by mEncoderLock, an encode holds it so the session can not be closed under it
+     */
+    private EncoderSession mEncoderSession;
+
+    private final Object mEncoderLock = new Object();
+
     private boolean mSafe;
 
     private long timeOfRecordingStart = -1;
@@ -480,12 +488,15 @@ public class Recorder implements ObdManager.ConnectionListener, LocationManager.
                         stopRecording();
                         return;
                     }
-                    int ret = -1;
+                    EncoderSession session = null;
                     try {
-                        ret = ffmpeg.initial(mSequence.getFolder().getPath() + "/");
+                        session = ffmpeg.initial(mSequence.getFolder().getPath() + "/");
                     } catch (Exception ignored) {
                     }
-                    if (ret != 0) {
+                    synchronized (mEncoderLock) {
+                        mEncoderSession = session;
+                    }
+                    if (session == null) {
                         Log.e(TAG, "startRecording: could not create video file");
                         mHandler.post(new Runnable() {
 
@@ -543,6 +554,13 @@ public class Recorder implements ObdManager.ConnectionListener, LocationManager.
         }
         recording = false;
         final LocalSequence finalSequence = mSequence;
+        //the session is closed in the background, a new recording can open its own session meanwhile.
+        //once taken under the lock no encode can still be running on it, whichever thread closes it
+        final EncoderSession finalEncoderSession;
+        synchronized (mEncoderLock) {
+            finalEncoderSession = mEncoderSession;
+            mEncoderSession = null;
+        }
         EventBus.clear(RecordingEvent.class);
         Runnable runnable = () -> {
 
@@ -577,8 +595,8 @@ public class Recorder implements ObdManager.ConnectionListener, LocationManager.
             mSensorManager.onPauseOrStop();
             setTimeOfRecordingStart(RECORD_TIME_START_NOT_SET);
             if (!mSafe) {
-                if (ffmpeg != null) {
-                    int ret = ffmpeg.close();
+                if (ffmpeg != null && finalEncoderSession != null) {
+                    int ret = ffmpeg.close(finalEncoderSession);
                     Log.d(TAG, "run: ffmpeg close: " + ret);
                 }
             }
@@ -915,7 +933,15 @@ public class Recorder implements ObdManager.ConnectionListener, LocationManager.
                         return;
                     }
                 } else {
-                    int[] ret = ffmpeg.encode(jpegData);
+                    int[] ret;
+                    synchronized (mEncoderLock) {
+                        if (mEncoderSession == null) {
+                            Log.w(TAG, "saveFrame: encoder session already closed");
+                            return;
+                        }
+                        ffmpeg.setLocation(mEncoderSession, location);
+                        ret = ffmpeg.encode(mEncoderSession, jpegData, timestamp);
+                    }
                     Log.d(TAG, "saveFrame: encoding done in " + (System.currentTimeMillis() - time) + " ms ,  video file " + ret[0] + " and frame " +
                             ret[1]);
                     if (ret[0] < 0 || ret[1] < 0) {
@@ -3,6 +3,8 @@ package com.telenav.osv.manager.capture;
 import android.database.sqlite.SQLiteConstraintException;
 import android.location.Location;
 import android.os.Handler;
+import android.util.SparseArray;
+import com.telenav.ffmpeg.EncoderSession;
 import com.telenav.ffmpeg.FFMPEG;
 import com.telenav.osv.db.SequenceDB;
 import com.telenav.osv.event.EventBus;
@@ -22,6 +24,10 @@ public class VideoSaver extends DataSaver {
 
     private FFMPEG ffmpeg;
 
+    private EncoderSession mEncoderSession;
+
+    private final SparseArray<PendingFrame> mPendingFrames = new SparseArray<>();
+
     public VideoSaver(LocalSequence sequence, Handler handler) {
         this.mSequence = sequence;
         this.ffmpeg = new FFMPEG(new FFMPEG.ErrorListener() {
@@ -33,12 +39,19 @@ public class VideoSaver extends DataSaver {
         });
         mBackgroundHandler = handler;
 
-        int ret = -1;
         try {
-            ret = ffmpeg.initial(sequence.getFolder().getPath() + "/");
+            mEncoderSession = ffmpeg.initial(sequence.getFolder().getPath() + "/");
         } catch (Exception ignored) {
         }
-        if (ret != 0) {
+        if (mEncoderSession != null) {
+            mEncoderSession.setEncodeListener(new EncoderSession.EncodeListener() {
+
+                @Override
+                public void onFrameEncoded(int ticket, int videoIndex, int frameIndex) {
+                    VideoSaver.this.onFrameEncoded(ticket, videoIndex, frameIndex);
+                }
+            });
+        } else {
             Log.e(TAG, "startSequence: could not create video file");
             Exception e = new Exception("Could not create video file. Try again please.");
             EventBus.post(new FrameSaveError(e, "Could not initialize/create mp4 file. Try again please."));
@@ -49,47 +62,63 @@ public class VideoSaver extends DataSaver {
     public void saveFrame(final byte[] jpegData, final Location mLocationF, final float mAccuracyF, final int mOrientationF,
                           final long mTimestampF) {
         super.saveFrame(jpegData, mLocationF, mAccuracyF, mOrientationF, mTimestampF);
-        final int mIndexF = mIndex;
-        mIndex++;
+        PendingFrame frame = new PendingFrame(mSequence, mLocationF, mAccuracyF, mOrientationF, mTimestampF);
+        // the encoder reports back on its own thread, the ticket is only known after submit returns
+        synchronized (mPendingFrames) {
+            ffmpeg.setLocation(mEncoderSession, mLocationF);
+            int ticket = ffmpeg.submit(mEncoderSession, jpegData, mTimestampF);
+            if (ticket >= 0) {
+                mPendingFrames.put(ticket, frame);
+                return;
+            }
+        }
+        Log.w(TAG, "saveFrame: encoder busy, dropping frame at " + mTimestampF);
+        EventBus.post(new ImageSavedEvent(frame.sequence, false));
+    }
+
+    private void onFrameEncoded(int ticket, final int videoIndex, final int frameIndex) {
+        final PendingFrame frame;
+        synchronized (mPendingFrames) {
+            frame = mPendingFrames.get(ticket);
+            mPendingFrames.remove(ticket);
+        }
+        if (frame == null) {
+            return;
+        }
+        Log.d(TAG, "saveFrame: encoding done in " + (System.currentTimeMillis() - frame.submitTime) + " ms ,  video file " + videoIndex +
+                " and frame " + frameIndex);
         mBackgroundHandler.post(new Runnable() {
 
             @Override
             public void run() {
-                //mRunDetection = false;
-                final long time = System.currentTimeMillis();
-                int[] ret;
-                ret = ffmpeg.encode(jpegData);
-                Log.d(TAG, "saveFrame: encoding done in " + (System.currentTimeMillis() - time) + " ms ,  video file " + ret[0] + " and frame " +
-                        ret[1]);
-                //mRunDetection = true;
-
-                if (ret[0] < 0 || ret[1] < 0) {
-                    mIndex--;
-                    EventBus.post(new ImageSavedEvent(mSequence, false));
-                    if (ret[0] < 0) {
+                LocalSequence sequence = frame.sequence;
+                if (videoIndex < 0 || frameIndex < 0) {
+                    EventBus.post(new ImageSavedEvent(sequence, false));
+                    if (videoIndex < 0) {
                         Exception e = new Exception("Could not initialize/create mp4 file. Try again please.");
                         EventBus.post(new FrameSaveError(e, "Could not initialize/create mp4 file. Try again please."));
                     }
                     return;
                 }
-                int mVideoIndexF = ret[0];
-                SensorManager.logVideoData(new VideoData(mIndexF, mVideoIndexF, mTimestampF));
+                // the frames complete in order, only the written ones get an index
+                final int index = mIndex++;
+                SensorManager.logVideoData(new VideoData(index, videoIndex, frame.timestamp));
                 try {
                     SequenceDB.instance
-                            .insertVideoIfNotAdded(mSequence.getId(), mVideoIndexF, mSequence.getFolder().getPath() + "/" + mVideoIndexF + ".mp4");
+                            .insertVideoIfNotAdded(sequence.getId(), videoIndex, sequence.getFolder().getPath() + "/" + videoIndex + ".mp4");
                 } catch (Exception ignored) {
                 }
 
                 try {
                     SequenceDB.instance
-                            .insertPhoto(mSequence.getId(), mVideoIndexF, mIndexF, mSequence.getFolder().getPath() + "/" + mVideoIndexF + ".mp4",
-                                    mLocationF.getLatitude(), mLocationF.getLongitude(), mAccuracyF, mOrientationF);
+                            .insertPhoto(sequence.getId(), videoIndex, index, sequence.getFolder().getPath() + "/" + videoIndex + ".mp4",
+                                    frame.location.getLatitude(), frame.location.getLongitude(), frame.accuracy, frame.orientation);
                 } catch (final SQLiteConstraintException e) {
                     EventBus.post(new FrameSaveError(e, "Recording stopped because SQL"));
                 }
 
-                mSequence.setFrameCount(mSequence.getFrameCount() + 1);
-                EventBus.post(new ImageSavedEvent(mSequence, true));
+                sequence.setFrameCount(sequence.getFrameCount() + 1);
+                EventBus.post(new ImageSavedEvent(sequence, true));
             }
         });
     }
@@ -97,8 +126,35 @@ public class VideoSaver extends DataSaver {
     @Override
     public void finish() {
         if (ffmpeg != null) {
-            ffmpeg.close();
+            ffmpeg.close(mEncoderSession);
+            mEncoderSession = null;
         }
         mSequence = null;
     }
+
+    /**
+     * Frame data waiting for the encoder to report the video file and frame index.
+     */
+    private static class PendingFrame {
+
+        final LocalSequence sequence;
+
+        final Location location;
+
+        final float accuracy;
+
+        final int orientation;
+
+        final long timestamp;
+
+        final long submitTime = System.currentTimeMillis();
+
+        PendingFrame(LocalSequence sequence, Location location, float accuracy, int orientation, long timestamp) {
+            this.sequence = sequence;
+            this.location = location;
+            this.accuracy = accuracy;
+            this.orientation = orientation;
+            this.timestamp = timestamp;
+        }
+    }
 }
@@ -0,0 +1,282 @@
+/*
+ * Replays a directory of jpeg frames through the encoder of the app, on the host, and prints
+ * what it cost as json: throughput, per frame latency, the stage histograms of the session,
+ * peak memory and the size of the output. See the Makefile for building it.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "encode.h"
+#include "encode_pipeline.h"
+
+typedef struct Corpus {
+    char **paths;
+    int count;
+} Corpus;
+
+typedef struct BenchOptions {
+    const char *input;
+    const char *output;
+    int async;
+    int frame_interval;         // ms between the capture times given to the encoder, 0 for none
+    float speed;                // speed hint in meters per second, negative for none
+    EncoderOptions encoder;
+} BenchOptions;
+
+/* Submission time of every ticket, async mode only. */
+static int64_t *submit_times;
+static int64_t *latencies;
+static int latency_count;
+static int failed;
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s -i jpeg_dir [-o out_dir] [-a] [-w encode_workers] [-k keyframe_interval]\n"
+                    "          [-f fragment_frames] [-m] [-s storage_per_km -v speed] [-t frame_interval_ms] [-x target_resolution]\n"
+                    "          [-p proxy_resolution]\n", name);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t len = strlen(name), suffix_len = strlen(suffix);
+    return len >= suffix_len && !strcasecmp(name + len - suffix_len, suffix);
+}
+
+/* The jpeg files of dir in name order, which is the capture order of the app's sequences. */
+static int read_corpus(const char *dir, Corpus *corpus) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    int capacity = 0;
+    if (!d) {
+        fprintf(stderr, "Could not open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    memset(corpus, 0, sizeof(Corpus));
+    while ((entry = readdir(d))) {
+        if (!has_suffix(entry->d_name, ".jpg") && !has_suffix(entry->d_name, ".jpeg")) {
+            continue;
+        }
+        if (corpus->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            corpus->paths = realloc(corpus->paths, capacity * sizeof(char *));
+        }
+        corpus->paths[corpus->count] = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+        sprintf(corpus->paths[corpus->count++], "%s/%s", dir, entry->d_name);
+    }
+    closedir(d);
+    qsort(corpus->paths, (size_t) corpus->count, sizeof(char *), compare_strings);
+    return corpus->count ? 0 : -1;
+}
+
+static void free_corpus(Corpus *corpus) {
+    int i;
+    for (i = 0; i < corpus->count; i++) {
+        free(corpus->paths[i]);
+    }
+    free(corpus->paths);
+}
+
+/* A job holding the whole file, read before the clock starts for it. */
+static EncodeJob *load_job(EncoderSession *s, const char *path) {
+    FILE *f = fopen(path, "rb");
+    EncodeJob *job = NULL;
+    long size;
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        job = encode_job_create(s, NULL, 0, (int) size);
+        if (job && fread(job->jpeg, 1, (size_t) size, f) != (size_t) size) {
+            encode_job_free(&job);
+        }
+    }
+    fclose(f);
+    return job;
+}
+
+static void on_complete(EncoderSession *s, EncodeJob *job) {
+    // called by the mux stage thread only, in ticket order
+    latencies[latency_count++] = encoder_stats_now() - submit_times[job->ticket];
+    failed += job->status < 0;
+}
+
+/* Size of the mp4 files of dir written since the benchmark started. */
+static int64_t output_bytes(const char *dir, time_t since) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    struct stat st;
+    char path[1024];
+    int64_t total = 0;
+    if (!d) {
+        return 0;
+    }
+    while ((entry = readdir(d))) {
+        snprintf(path, sizeof(path), "%s%s", dir, entry->d_name);
+        if (has_suffix(entry->d_name, ".mp4") && !stat(path, &st) && st.st_mtime >= since) {
+            total += st.st_size;
+        }
+    }
+    closedir(d);
+    return total;
+}
+
+static void print_percentiles(const char *name, int64_t *values, int count) {
+    qsort(values, (size_t) count, sizeof(int64_t), compare_int64);
+    printf("  \"%s\": {\"p50\": %lld, \"p95\": %lld, \"p99\": %lld, \"max\": %lld},\n", name,
+           (long long) values[count / 2], (long long) values[(int64_t) count * 95 / 100],
+           (long long) values[(int64_t) count * 99 / 100], (long long) values[count - 1]);
+}
+
+static void print_stats(EncoderStats *stats) {
+    static const char *names[ENCODER_STATS_METRICS] = {
+            "decode", "rotate", "convert", "encode", "mux", "rollover", "frame_size",
+            "queue_decode", "queue_filter", "queue_encode", "queue_mux"
+    };
+    int64_t summary[ENCODER_STATS_METRICS * ENCODER_STATS_SUMMARY_SIZE];
+    int i;
+    encoder_stats_summary(stats, summary);
+    printf("  \"stages\": {\n");
+    for (i = 0; i < ENCODER_STATS_METRICS; i++) {
+        int64_t *v = summary + i * ENCODER_STATS_SUMMARY_SIZE;
+        printf("    \"%s\": {\"count\": %lld, \"p50\": %lld, \"p95\": %lld, \"p99\": %lld, \"max\": %lld}%s\n", names[i],
+               (long long) v[0], (long long) v[1], (long long) v[2], (long long) v[3], (long long) v[4],
+               i + 1 < ENCODER_STATS_METRICS ? "," : "");
+    }
+    printf("  },\n");
+}
+
+static int parse_options(int argc, char **argv, BenchOptions *o) {
+    int c;
+    memset(o, 0, sizeof(BenchOptions));
+    o->output = "/tmp/encode_bench";
+    o->speed = -1;
+    while ((c = getopt(argc, argv, "i:o:aw:k:f:ms:v:t:x:p:")) != -1) {
+        switch (c) {
+            case 'i': o->input = optarg; break;
+            case 'o': o->output = optarg; break;
+            case 'a': o->async = 1; break;
+            case 'w': o->encoder.encode_workers = atoi(optarg); break;
+            case 'k': o->encoder.keyframe_interval = atoi(optarg); break;
+            case 'f': o->encoder.fragment_frames = atoi(optarg); break;
+            case 'm': o->encoder.metadata_orientation = 1; break;
+            case 's': o->encoder.storage_per_km = atoi(optarg); break;
+            case 'v': o->speed = (float) atof(optarg); break;
+            case 't': o->frame_interval = atoi(optarg); break;
+            case 'x': o->encoder.target_resolution = atoi(optarg); break;
+            case 'p': o->encoder.proxy_resolution = atoi(optarg); break;
+            default: return -1;
+        }
+    }
+    return o->input ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions o;
+    Corpus corpus;
+    EncoderSession *s;
+    EncodeJob **jobs;
+    char folder[1024];
+    struct rusage usage_info;
+    int i;
+
+    if (parse_options(argc, argv, &o) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (read_corpus(o.input, &corpus) < 0) {
+        fprintf(stderr, "No jpeg in %s\n", o.input);
+        return 1;
+    }
+    time_t started = time(NULL);
+    mkdir(o.output, 0755);
+    snprintf(folder, sizeof(folder), "%s/", o.output);
+
+    av_register_all();
+    s = encoder_session_create(folder, &o.encoder);
+    if (!s) {
+        fprintf(stderr, "Could not create the encoder session\n");
+        return 1;
+    }
+    if (o.speed >= 0) {
+        rate_control_set_speed(&s->rate_control, o.speed);
+    }
+
+    // the whole corpus is read up front so the disk is not part of the measurement
+    jobs = calloc((size_t) corpus.count, sizeof(EncodeJob *));
+    submit_times = calloc((size_t) corpus.count, sizeof(int64_t));
+    latencies = calloc((size_t) corpus.count, sizeof(int64_t));
+    for (i = 0; i < corpus.count; i++) {
+        jobs[i] = load_job(s, corpus.paths[i]);
+        if (!jobs[i]) {
+            return 1;
+        }
+        jobs[i]->capture_time = o.frame_interval > 0 ? (int64_t) i * o.frame_interval : -1;
+    }
+
+    int64_t start = encoder_stats_now();
+    if (o.async) {
+        s->on_complete = on_complete;
+        s->pipeline = pipeline_start(s);
+        if (!s->pipeline) {
+            fprintf(stderr, "Could not start the encode pipeline\n");
+            return 1;
+        }
+        for (i = 0; i < corpus.count; i++) {
+            submit_times[jobs[i]->ticket] = encoder_stats_now();
+            // the app drops a frame when the pipeline is full, the benchmark waits for room instead
+            while (pipeline_submit(s->pipeline, jobs[i]) < 0) {
+                usleep(500);
+            }
+        }
+        pipeline_stop(&s->pipeline);
+    } else {
+        int stage;
+        for (i = 0; i < corpus.count; i++) {
+            int64_t frame_start = encoder_stats_now();
+            for (stage = 0; stage < ENCODE_STAGES; stage++) {
+                encode_job_run_stage(s, jobs[i], stage);
+            }
+            failed += jobs[i]->status < 0;
+            encode_job_free(&jobs[i]);
+            latencies[latency_count++] = encoder_stats_now() - frame_start;
+        }
+    }
+    // the trailer of the last segment is written when the session is closed
+    EncoderStats stats = s->stats;
+    encoder_session_free(&s);
+    double seconds = (encoder_stats_now() - start) / 1000000.0;
+    int64_t bytes = output_bytes(folder, started);
+    getrusage(RUSAGE_SELF, &usage_info);
+
+    printf("{\n");
+    printf("  \"frames\": %d,\n  \"failed\": %d,\n", corpus.count, failed);
+    printf("  \"seconds\": %.3f,\n  \"fps\": %.2f,\n", seconds, corpus.count / seconds);
+    if (latency_count) {
+        print_percentiles("latency_us", latencies, latency_count);
+    }
+    print_stats(&stats);
+    printf("  \"peak_rss_kb\": %ld,\n", usage_info.ru_maxrss);
+    printf("  \"output_bytes\": %lld,\n  \"bytes_per_frame\": %.0f\n", (long long) bytes, (double) bytes / corpus.count);
+    printf("}\n");
+
+    free(jobs);
+    free(submit_times);
+    free(latencies);
+    free_corpus(&corpus);
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef BENCH_ANDROID_LOG_H_
+#define BENCH_ANDROID_LOG_H_
+
+enum {
+    ANDROID_LOG_VERBOSE = 2,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR
+};
+
+/* Prints the errors to stderr, the rest is dropped so it does not weigh on the measurements. */
+int __android_log_print(int prio, const char *tag, const char *fmt, ...);
+
+#endif /* BENCH_ANDROID_LOG_H_ */
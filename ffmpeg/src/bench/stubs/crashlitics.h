@@ -0,0 +1,11 @@
+#ifndef BENCH_CRASHLITICS_H_
+#define BENCH_CRASHLITICS_H_
+
+/* No crash reporting on the host. */
+typedef struct crashlytics_context crashlytics_context_t;
+
+static inline void crashlytics_free(crashlytics_context_t **context) {
+    *context = 0;
+}
+
+#endif /* BENCH_CRASHLITICS_H_ */
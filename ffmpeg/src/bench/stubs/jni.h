@@ -0,0 +1,74 @@
+/*
+ * Just enough of jni.h to compile encode.c on a host, the java entry points are never called by the benchmark.
+ */
+#ifndef BENCH_JNI_H_
+#define BENCH_JNI_H_
+
+#include <stdint.h>
+
+typedef uint8_t jboolean;
+typedef int8_t jbyte;
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef float jfloat;
+typedef double jdouble;
+typedef jint jsize;
+
+typedef void *jobject;
+typedef jobject jclass;
+typedef jobject jstring;
+typedef jobject jarray;
+typedef jobject jbyteArray;
+typedef jobject jintArray;
+typedef jobject jlongArray;
+
+typedef struct _jfieldID *jfieldID;
+typedef struct _jmethodID *jmethodID;
+
+#define JNI_OK 0
+#define JNI_EDETACHED (-2)
+#define JNI_ABORT 2
+#define JNI_VERSION_1_6 0x00010006
+#define JNIEXPORT
+#define JNICALL
+
+struct JNINativeInterface;
+struct JNIInvokeInterface;
+typedef const struct JNINativeInterface *JNIEnv;
+typedef const struct JNIInvokeInterface *JavaVM;
+
+struct JNINativeInterface {
+    jclass (*FindClass)(JNIEnv *, const char *);
+    jclass (*GetObjectClass)(JNIEnv *, jobject);
+    jmethodID (*GetMethodID)(JNIEnv *, jclass, const char *, const char *);
+    jfieldID (*GetFieldID)(JNIEnv *, jclass, const char *, const char *);
+    void (*CallVoidMethod)(JNIEnv *, jobject, jmethodID, ...);
+    jobject (*NewGlobalRef)(JNIEnv *, jobject);
+    void (*DeleteGlobalRef)(JNIEnv *, jobject);
+    void (*DeleteLocalRef)(JNIEnv *, jobject);
+    jint (*GetJavaVM)(JNIEnv *, JavaVM **);
+    const char *(*GetStringUTFChars)(JNIEnv *, jstring, jboolean *);
+    void (*ReleaseStringUTFChars)(JNIEnv *, jstring, const char *);
+    void (*GetByteArrayRegion)(JNIEnv *, jbyteArray, jsize, jsize, jbyte *);
+    jsize (*GetArrayLength)(JNIEnv *, jarray);
+    void *(*GetPrimitiveArrayCritical)(JNIEnv *, jarray, jboolean *);
+    void (*ReleasePrimitiveArrayCritical)(JNIEnv *, jarray, void *, jint);
+    jintArray (*NewIntArray)(JNIEnv *, jsize);
+    void (*SetIntArrayRegion)(JNIEnv *, jintArray, jsize, jsize, const jint *);
+    jlongArray (*NewLongArray)(JNIEnv *, jsize);
+    void (*SetLongArrayRegion)(JNIEnv *, jlongArray, jsize, jsize, const jlong *);
+    void *(*GetDirectBufferAddress)(JNIEnv *, jobject);
+    jlong (*GetDirectBufferCapacity)(JNIEnv *, jobject);
+    jboolean (*ExceptionCheck)(JNIEnv *);
+    void (*ExceptionClear)(JNIEnv *);
+    jint (*GetIntField)(JNIEnv *, jobject, jfieldID);
+    jboolean (*GetBooleanField)(JNIEnv *, jobject, jfieldID);
+};
+
+struct JNIInvokeInterface {
+    jint (*AttachCurrentThread)(JavaVM *, JNIEnv **, void *);
+    jint (*DetachCurrentThread)(JavaVM *);
+    jint (*GetEnv)(JavaVM *, void **, jint);
+};
+
+#endif /* BENCH_JNI_H_ */
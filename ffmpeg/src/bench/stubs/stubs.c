@@ -0,0 +1,22 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "android/log.h"
+#include "crash_handler.h"
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+    va_list vl;
+    if (prio < ANDROID_LOG_ERROR) {
+        return 0;
+    }
+    va_start(vl, fmt);
+    fprintf(stderr, "%s", tag);
+    vfprintf(stderr, fmt, vl);
+    fputc('\n', stderr);
+    va_end(vl);
+    return 0;
+}
+
+int initSignalHandler(void (*response)()) {
+    return 0;
+}
@@ -0,0 +1,128 @@
+package com.telenav.ffmpeg;
+
+/**
+ * Settings of a new encoder session, see {@link FFMPEG#initial(String, EncoderOptions)}.
+ * The fields are read by the native code when the session is created.
+ */
+public class EncoderOptions {
+
+    private boolean mMetadataOrientation;
+
+    private int mFragmentFrames;
+
+    private int mEncodeWorkers = 1;
+
+    private int mKeyframeInterval;
+
+    private int mStoragePerKm;
+
+    private int mTargetResolution;
+
+    private int mProxyResolution;
+
+    /**
+     * @param metadataOrientation if true the frames are not rotated, their orientation is written in the track header
+     * and, frame by frame, as a display orientation SEI message, so a device turn no longer starts a new file
+     */
+    public EncoderOptions setMetadataOrientation(boolean metadataOrientation) {
+        this.mMetadataOrientation = metadataOrientation;
+        return this;
+    }
+
+    public boolean isMetadataOrientation() {
+        return mMetadataOrientation;
+    }
+
+    /**
+     * Writes fragmented mp4 files, with a fragment every given number of frames. A file stays playable up to its
+     * last complete fragment if the recording is interrupted, and closing it does not write a whole index.
+     * @param fragmentFrames frames per fragment, 0 for regular mp4 files
+     */
+    public EncoderOptions setFragmentFrames(int fragmentFrames) {
+        this.mFragmentFrames = Math.max(0, fragmentFrames);
+        return this;
+    }
+
+    public int getFragmentFrames() {
+        return mFragmentFrames;
+    }
+
+    /**
+     * Spreads the frames given to {@link FFMPEG#submit(EncoderSession, byte[])} over several h264 encoders, each on its own
+     * thread. Every frame is an intra frame, so the encoders are independent; the frames are still written in order.
+     * Ignored when a keyframe interval is set.
+     * <p>
+     * The encoders number their idr frames independently, so consecutive frames from two encoders can share an
+     * idr_pic_id. The files are not strictly conformant h264: ffmpeg decodes them, a hardware decoder may not.
+     * Off by default.
+     * @param encodeWorkers number of encoders, 1 to 8, 1 by default
+     */
+    public EncoderOptions setEncodeWorkers(int encodeWorkers) {
+        this.mEncodeWorkers = Math.max(1, Math.min(8, encodeWorkers));
+        return this;
+    }
+
+    public int getEncodeWorkers() {
+        return mEncodeWorkers;
+    }
+
+    /**
+     * Encodes predicted frames between the keyframes instead of intra frames only, which makes the files several times
+     * smaller. Every file still starts with an idr frame; the player seeks to the previous keyframe and decodes forward
+     * to the requested frame.
+     * @param keyframeInterval frames between two keyframes, 0 for intra only files
+     */
+    public EncoderOptions setKeyframeInterval(int keyframeInterval) {
+        this.mKeyframeInterval = Math.max(0, keyframeInterval);
+        return this;
+    }
+
+    public int getKeyframeInterval() {
+        return mKeyframeInterval;
+    }
+
+    /**
+     * Replaces the fixed bitrate by a quality chosen frame by frame, so a recording stays close to the given storage per
+     * kilometre: more bytes at speed and on busy scenes, the fewest possible while standing still. The speed is given
+     * with {@link FFMPEG#setSpeed(EncoderSession, float)}, the scene changes are measured on the frames.
+     * @param kilobytesPerKm storage budget, 0 for the fixed bitrate
+     */
+    public EncoderOptions setStoragePerKm(int kilobytesPerKm) {
+        this.mStoragePerKm = Math.max(0, kilobytesPerKm);
+        return this;
+    }
+
+    public int getStoragePerKm() {
+        return mStoragePerKm;
+    }
+
+    /**
+     * Encodes the frames at a lower resolution than they were captured at. Jpegs are decoded straight at 1/2, 1/4 or 1/8
+     * of their size when that is still enough, the rest of the reduction is an area average, so decoding, encoding and
+     * the files all get cheaper with the pixel count.
+     * @param shortSide height of landscape frames, width of portrait ones, in pixels (720, 1080...), 0 for the captured size
+     */
+    public EncoderOptions setTargetResolution(int shortSide) {
+        this.mTargetResolution = Math.max(0, shortSide);
+        return this;
+    }
+
+    public int getTargetResolution() {
+        return mTargetResolution;
+    }
+
+    /**
+     * Also writes a low resolution, more compressed copy of every video file, from the same decoded frames, for reviewing
+     * the sequence on the phone. {@link FFMPEGTrackPlayer} plays the copies when they are there. They are found with
+     * {@link FFMPEG#getProxyPath(String)} and are not meant to be uploaded.
+     * @param shortSide height of landscape frames, width of portrait ones, in pixels (480...), 0 for no copy
+     */
+    public EncoderOptions setProxyResolution(int shortSide) {
+        this.mProxyResolution = Math.max(0, shortSide);
+        return this;
+    }
+
+    public int getProxyResolution() {
+        return mProxyResolution;
+    }
+}
@@ -0,0 +1,107 @@
+package com.telenav.ffmpeg;
+
+/**
+ * Handle to a native encoder session, as returned by {@link FFMPEG#initial(String)}.
+ * Every session owns its own decoder, encoder and output files, so a finishing sequence can be closed
+ * while the next one is already encoding. A single session should only be used from one thread at a time, except for
+ * the calls documented otherwise and {@link FFMPEG#close(EncoderSession)}, which waits for the calls in progress.
+ * Frames can either be encoded synchronously with {@link FFMPEG#encode(EncoderSession, byte[])} or handed to the
+ * session's encode threads with {@link FFMPEG#submit(EncoderSession, byte[])}, but not both on the same session.
+ */
+public class EncoderSession {
+
+    private final String mFolder;
+
+    // guarded by this: the context is only freed once no call uses it
+    private long mNativeContext;
+
+    private int mUsers;
+
+    private volatile EncodeListener mEncodeListener;
+
+    EncoderSession(long nativeContext, String folder) {
+        this.mNativeContext = nativeContext;
+        this.mFolder = folder;
+    }
+
+    /**
+     * @return the folder the video files of this session are written to
+     */
+    public String getFolder() {
+        return mFolder;
+    }
+
+    /**
+     * @return true if {@link FFMPEG#close(EncoderSession)} was already called on this session
+     */
+    public synchronized boolean isClosed() {
+        return mNativeContext == 0;
+    }
+
+    /**
+     * Marks the native context as used by a call, it is not freed until {@link #release()}.
+     * @return the context, 0 if the session is closed
+     */
+    synchronized long acquire() {
+        if (mNativeContext != 0) {
+            mUsers++;
+        }
+        return mNativeContext;
+    }
+
+    synchronized void release() {
+        if (--mUsers == 0) {
+            notifyAll();
+        }
+    }
+
+    /**
+     * Closes the session for new calls and waits for the ones in progress.
+     * @return the context to free, 0 if the session was already closed
+     */
+    synchronized long detach() {
+        long context = mNativeContext;
+        mNativeContext = 0;
+        boolean interrupted = false;
+        while (mUsers > 0) {
+            try {
+                wait();
+            } catch (InterruptedException e) {
+                interrupted = true;
+            }
+        }
+        if (interrupted) {
+            Thread.currentThread().interrupt();
+        }
+        return context;
+    }
+
+    /**
+     * Sets the listener notified when a frame given to {@link FFMPEG#submit(EncoderSession, byte[])} was written.
+     */
+    public void setEncodeListener(EncodeListener listener) {
+        this.mEncodeListener = listener;
+    }
+
+    /**
+     * Called from the native mux thread.
+     */
+    void onFrameEncoded(int ticket, int videoIndex, int frameIndex) {
+        EncodeListener listener = mEncodeListener;
+        if (listener != null) {
+            listener.onFrameEncoded(ticket, videoIndex, frameIndex);
+        }
+    }
+
+    public interface EncodeListener {
+
+        /**
+         * Called on a native encoder thread for every submitted frame, in submission order.
+         * Must not block, and must not close the session.
+         * @param ticket the value returned by submit for this frame
+         * @param videoIndex the index of the video file, -1 if the frame could not be decoded
+         * @param frameIndex the index of the frame in the video file, -1 on error
+         */
+        void onFrameEncoded(int ticket, int videoIndex, int frameIndex);
+    }
+}
@@ -0,0 +1,87 @@
+package com.telenav.ffmpeg;
+
+/**
+ * Per frame costs measured by an encoder session since it was opened, see {@link FFMPEG#getEncoderStats(EncoderSession)}.
+ * Every metric is summarized by its count, percentiles and maximum. Percentiles come from a log scale histogram
+ * and are rounded up by at most 25%.
+ */
+public class EncoderStats {
+
+    /** jpeg decode time, microseconds */
+    public static final int DECODE = 0;
+
+    /** orientation filter time, microseconds */
+    public static final int ROTATE = 1;
+
+    /** color conversion and scaling time, microseconds */
+    public static final int CONVERT = 2;
+
+    /** h264 encode time, microseconds */
+    public static final int ENCODE = 3;
+
+    /** mux and file write time, microseconds */
+    public static final int MUX = 4;
+
+    /** time taken to start a new video file, microseconds */
+    public static final int ROLLOVER = 5;
+
+    /** size of the encoded frames, bytes */
+    public static final int FRAME_SIZE = 6;
+
+    /** frames waiting for the decode stage of the submit pipeline */
+    public static final int QUEUE_DECODE = 7;
+
+    /** frames waiting for the filter stage of the submit pipeline */
+    public static final int QUEUE_FILTER = 8;
+
+    /** frames waiting for the encode stage of the submit pipeline */
+    public static final int QUEUE_ENCODE = 9;
+
+    /** frames waiting for the mux stage of the submit pipeline */
+    public static final int QUEUE_MUX = 10;
+
+    public static final int METRIC_COUNT = 11;
+
+    private static final int SUMMARY_SIZE = 5;
+
+    private final long[] mSummary;
+
+    EncoderStats(long[] summary) {
+        this.mSummary = summary;
+    }
+
+    public long getCount(int metric) {
+        return mSummary[metric * SUMMARY_SIZE];
+    }
+
+    public long getP50(int metric) {
+        return mSummary[metric * SUMMARY_SIZE + 1];
+    }
+
+    public long getP95(int metric) {
+        return mSummary[metric * SUMMARY_SIZE + 2];
+    }
+
+    public long getP99(int metric) {
+        return mSummary[metric * SUMMARY_SIZE + 3];
+    }
+
+    public long getMax(int metric) {
+        return mSummary[metric * SUMMARY_SIZE + 4];
+    }
+
+    @Override
+    public String toString() {
+        String[] names = {"decode", "rotate", "convert", "encode", "mux", "rollover", "frameSize", "queueDecode", "queueFilter",
+                "queueEncode", "queueMux"};
+        StringBuilder sb = new StringBuilder("EncoderStats{");
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            if (getCount(i) == 0) {
+                continue;
+            }
+            sb.append(names[i]).append(": n=").append(getCount(i)).append(" p50=").append(getP50(i)).append(" p95=")
+                    .append(getP95(i)).append(" p99=").append(getP99(i)).append(" max=").append(getMax(i)).append("; ");
+        }
+        return sb.append('}').toString();
+    }
+}
@@ -1,9 +1,22 @@
 package com.telenav.ffmpeg;
 
+import android.location.Location;
+
+import java.nio.ByteBuffer;
+
 public class FFMPEG {
 
     private static final String TAG = "FFMPEG";
 
+    // see frame_metadata.h
+    private static final int LOCATION_HAS_POSITION = 1;
+
+    private static final int LOCATION_HAS_BEARING = 2;
+
+    private static final int LOCATION_HAS_SPEED = 4;
+
+    private static final int LOCATION_HAS_ACCURACY = 8;
+
     static {
         System.loadLibrary("avutil");
         System.loadLibrary("swscale");
@@ -21,12 +34,388 @@ public class FFMPEG {
         this.mErrorListener = listener;
     }
 
+    /**
+     * The low resolution copy written next to a video file when {@link EncoderOptions#setProxyResolution(int)} is set.
+     * It has the same frames as the video, only smaller, and is not meant to be uploaded.
+     * @param videoPath path of a video file written by a session
+     */
+    public static String getProxyPath(String videoPath) {
+        if (videoPath.endsWith(".mp4")) {
+            return videoPath.substring(0, videoPath.length() - ".mp4".length()) + ".proxy.mp4";
+        }
+        return videoPath + ".proxy.mp4";
+    }
+
+    /**
+     * Opens a new encoder session writing numbered mp4 files into the given folder.
+     * Sessions are independent, several of them can be open at the same time.
+     * @param folder the output folder, ending with a separator
+     * @return the session, or null if the encoder could not be initialized
+     */
+    public EncoderSession initial(String folder) {
+        return initial(folder, null);
+    }
+
+    /**
+     * Same as {@link #initial(String)}, with the given settings.
+     * @param options the settings of the session, null for the defaults
+     * @return the session, or null if the encoder could not be initialized
+     */
+    public EncoderSession initial(String folder, EncoderOptions options) {
+        long context = nativeInitial(folder, options);
+        if (context == 0) {
+            return null;
+        }
+        return new EncoderSession(context, folder);
+    }
+
+    /**
+     * Encodes a jpeg frame into the current video file of the session.
+     * @return {video file index, frame index in the file}, negative values on error
+     */
+    public int[] encode(EncoderSession session, byte[] jpeg) {
+        return encode(session, jpeg, -1);
+    }
+
+    /**
+     * Same as {@link #encode(EncoderSession, byte[])}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int[] encode(EncoderSession session, byte[] jpeg, long captureTimeMs) {
+        if (session == null) {
+            return new int[]{-1, -1};
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return new int[]{-1, -1};
+        }
+        try {
+            return nativeEncode(context, jpeg, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Encodes a jpeg frame held in a direct buffer, e.g. a camera Image plane, without copying it to the java heap.
+     * The jpeg is decoded in place if the buffer has at least 32 bytes left after it, it is copied once otherwise.
+     * @param jpeg a direct buffer
+     * @param offset the position of the jpeg in the buffer
+     * @param length the size of the jpeg
+     * @return {video file index, frame index in the file}, negative values on error
+     */
+    public int[] encodeDirect(EncoderSession session, ByteBuffer jpeg, int offset, int length) {
+        return encodeDirect(session, jpeg, offset, length, -1);
+    }
+
+    /**
+     * Same as {@link #encodeDirect(EncoderSession, ByteBuffer, int, int)}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int[] encodeDirect(EncoderSession session, ByteBuffer jpeg, int offset, int length, long captureTimeMs) {
+        if (session == null || jpeg == null || !jpeg.isDirect()) {
+            return new int[]{-1, -1};
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return new int[]{-1, -1};
+        }
+        try {
+            return nativeEncodeDirect(context, jpeg, offset, length, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Hands a jpeg frame to the encode threads of the session and returns without waiting for it.
+     * The result is delivered to the session's {@link EncoderSession.EncodeListener} with the returned ticket.
+     * @return the ticket of the frame, or -1 if the frame was dropped because the encoder is still busy with the previous ones
+     */
+    public int submit(EncoderSession session, byte[] jpeg) {
+        return submit(session, jpeg, -1);
+    }
+
+    /**
+     * Same as {@link #submit(EncoderSession, byte[])}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int submit(EncoderSession session, byte[] jpeg, long captureTimeMs) {
+        if (session == null) {
+            return -1;
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return -1;
+        }
+        try {
+            return nativeSubmit(context, session, jpeg, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Same as {@link #submit(EncoderSession, byte[])} for a jpeg held in a direct buffer, see
+     * {@link #encodeDirect(EncoderSession, ByteBuffer, int, int)}. The buffer is referenced until the frame is reported to the
+     * listener, its content must not be changed before.
+     * @return the ticket of the frame, or -1 if the frame was dropped
+     */
+    public int submitDirect(EncoderSession session, ByteBuffer jpeg, int offset, int length) {
+        return submitDirect(session, jpeg, offset, length, -1);
+    }
+
+    /**
+     * Same as {@link #submitDirect(EncoderSession, ByteBuffer, int, int)}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int submitDirect(EncoderSession session, ByteBuffer jpeg, int offset, int length, long captureTimeMs) {
+        if (session == null || jpeg == null || !jpeg.isDirect()) {
+            return -1;
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return -1;
+        }
+        try {
+            return nativeSubmitDirect(context, session, jpeg, offset, length, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Encodes a raw camera frame in the YUV_420_888 format, e.g. the planes of an android.media.Image,
+     * skipping the jpeg compression and decompression. The planes are copied before this returns.
+     * @param y the luma plane, a direct buffer
+     * @param u the cb plane, a direct buffer
+     * @param v the cr plane, a direct buffer
+     * @param rotation the clockwise rotation to apply to the frame, in degrees
+     * @return {video file index, frame index in the file}, negative values on error
+     */
+    public int[] encodeYuv(EncoderSession session, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride, int uvRowStride,
+                           int uvPixelStride, int width, int height, int rotation) {
+        return encodeYuv(session, y, u, v, yRowStride, uvRowStride, uvPixelStride, width, height, rotation, -1);
+    }
+
+    /**
+     * Same as {@link #encodeYuv}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int[] encodeYuv(EncoderSession session, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride, int uvRowStride,
+                           int uvPixelStride, int width, int height, int rotation, long captureTimeMs) {
+        if (session == null || !isDirect(y, u, v)) {
+            return new int[]{-1, -1};
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return new int[]{-1, -1};
+        }
+        try {
+            return nativeEncodeYuv(context, y, u, v, yRowStride, uvRowStride, uvPixelStride, width, height, rotation,
+                    captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Asynchronous version of {@link #encodeYuv}, the planes can be reused as soon as this returns.
+     * @return the ticket of the frame, or -1 if the frame was dropped
+     */
+    public int submitYuv(EncoderSession session, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride, int uvRowStride,
+                         int uvPixelStride, int width, int height, int rotation) {
+        return submitYuv(session, y, u, v, yRowStride, uvRowStride, uvPixelStride, width, height, rotation, -1);
+    }
+
+    /**
+     * Same as {@link #submitYuv}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int submitYuv(EncoderSession session, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride, int uvRowStride,
+                         int uvPixelStride, int width, int height, int rotation, long captureTimeMs) {
+        if (session == null || !isDirect(y, u, v)) {
+            return -1;
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return -1;
+        }
+        try {
+            return nativeSubmitYuv(context, session, y, u, v, yRowStride, uvRowStride, uvPixelStride, width, height, rotation,
+                    captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Encodes a raw NV21 camera frame, the default preview format of android.hardware.Camera.
+     * @param rotation the clockwise rotation to apply to the frame, in degrees
+     * @return {video file index, frame index in the file}, negative values on error
+     */
+    public int[] encodeNv21(EncoderSession session, byte[] nv21, int width, int height, int rotation) {
+        return encodeNv21(session, nv21, width, height, rotation, -1);
+    }
+
+    /**
+     * Same as {@link #encodeNv21(EncoderSession, byte[], int, int, int)}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int[] encodeNv21(EncoderSession session, byte[] nv21, int width, int height, int rotation, long captureTimeMs) {
+        if (session == null || nv21 == null) {
+            return new int[]{-1, -1};
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return new int[]{-1, -1};
+        }
+        try {
+            return nativeEncodeNv21(context, nv21, width, height, rotation, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Asynchronous version of {@link #encodeNv21}, the array can be reused as soon as this returns.
+     * @return the ticket of the frame, or -1 if the frame was dropped
+     */
+    public int submitNv21(EncoderSession session, byte[] nv21, int width, int height, int rotation) {
+        return submitNv21(session, nv21, width, height, rotation, -1);
+    }
+
+    /**
+     * Same as {@link #submitNv21(EncoderSession, byte[], int, int, int)}, with the time the frame was captured.
+     * @param captureTimeMs capture time in milliseconds, e.g. from System.currentTimeMillis(), -1 if unknown
+     */
+    public int submitNv21(EncoderSession session, byte[] nv21, int width, int height, int rotation, long captureTimeMs) {
+        if (session == null || nv21 == null) {
+            return -1;
+        }
+        long context = session.acquire();
+        if (context == 0) {
+            return -1;
+        }
+        try {
+            return nativeSubmitNv21(context, session, nv21, width, height, rotation, captureTimeMs);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Sets the current speed, used by the rate control of the frames given from now on, see
+     * {@link EncoderOptions#setStoragePerKm(int)}. Can be called from any thread, e.g. on every location update.
+     * @param metersPerSecond the speed, negative if unknown
+     */
+    public void setSpeed(EncoderSession session, float metersPerSecond) {
+        long context = session == null ? 0 : session.acquire();
+        if (context == 0) {
+            return;
+        }
+        try {
+            nativeSetSpeed(context, metersPerSecond);
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Sets the current location, written into each frame given from now on as a user data SEI message of the video
+     * track, so the position of every frame travels with the video. The speed, if any, is also used like
+     * {@link #setSpeed(EncoderSession, float)}. Call it before handing the frame taken at that location to the encoder.
+     * @param location the location, null to stop writing locations
+     */
+    public void setLocation(EncoderSession session, Location location) {
+        long context = session == null ? 0 : session.acquire();
+        if (context == 0) {
+            return;
+        }
+        try {
+            if (location == null) {
+                nativeSetLocation(context, 0, 0, 0, 0, 0, 0, 0);
+                return;
+            }
+            int flags = LOCATION_HAS_POSITION;
+            flags |= location.hasBearing() ? LOCATION_HAS_BEARING : 0;
+            flags |= location.hasSpeed() ? LOCATION_HAS_SPEED : 0;
+            flags |= location.hasAccuracy() ? LOCATION_HAS_ACCURACY : 0;
+            nativeSetLocation(context, flags, location.getLatitude(), location.getLongitude(), location.getBearing(),
+                    location.getSpeed(), location.getAccuracy(), location.getTime());
+        } finally {
+            session.release();
+        }
+    }
+
+    /**
+     * Returns the timings of the encoder stages, frame sizes and queue depths measured so far by the session.
+     * Can be called from any thread while the session is encoding.
+     * @return the statistics, or null if the session is closed
+     */
+    public EncoderStats getEncoderStats(EncoderSession session) {
+        long context = session == null ? 0 : session.acquire();
+        if (context == 0) {
+            return null;
+        }
+        long[] summary;
+        try {
+            summary = nativeGetEncoderStats(context);
+        } finally {
+            session.release();
+        }
+        return summary == null ? null : new EncoderStats(summary);
+    }
+
+    /**
+     * Flushes the last video file and releases the session. Can be called from any thread, it waits for the calls
+     * already running on the session, the ones made after it starts are ignored.
+     * Frames already submitted are encoded, and their listener called, before this returns.
+     * @return 0 on success, 1 if no frames were written, -1 if the session was already closed
+     */
+    public int close(EncoderSession session) {
+        long context = session == null ? 0 : session.detach();
+        if (context == 0) {
+            return -1;
+        }
+        return nativeClose(context);
+    }
+
     //JNI
-    public native int initial(String folder);
+    private native long nativeInitial(String folder, EncoderOptions options);
 
-    public native int[] encode(byte[] yuvimage);
+    private native int[] nativeEncode(long session, byte[] jpeg, long captureTimeMs);
 
-    public native int close();
+    private native int[] nativeEncodeDirect(long session, ByteBuffer jpeg, int offset, int length, long captureTimeMs);
+
+    private native int nativeSubmit(long session, EncoderSession jsession, byte[] jpeg, long captureTimeMs);
+
+    private native int nativeSubmitDirect(long session, EncoderSession jsession, ByteBuffer jpeg, int offset, int length,
+                                          long captureTimeMs);
+
+    private native int[] nativeEncodeYuv(long session, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride, int uvRowStride,
+                                         int uvPixelStride, int width, int height, int rotation, long captureTimeMs);
+
+    private native int nativeSubmitYuv(long session, EncoderSession jsession, ByteBuffer y, ByteBuffer u, ByteBuffer v, int yRowStride,
+                                       int uvRowStride, int uvPixelStride, int width, int height, int rotation, long captureTimeMs);
+
+    private native int[] nativeEncodeNv21(long session, byte[] nv21, int width, int height, int rotation, long captureTimeMs);
+
+    private native int nativeSubmitNv21(long session, EncoderSession jsession, byte[] nv21, int width, int height, int rotation,
+                                        long captureTimeMs);
+
+    private native long[] nativeGetEncoderStats(long session);
+
+    private native void nativeSetSpeed(long session, float metersPerSecond);
+
+    private native void nativeSetLocation(long session, int flags, double latitude, double longitude, float bearing, float speed,
+                                          float accuracy, long time);
+
+    private native int nativeClose(long session);
+
+    private static boolean isDirect(ByteBuffer y, ByteBuffer u, ByteBuffer v) {
+        return y != null && u != null && v != null && y.isDirect() && u.isDirect() && v.isDirect();
+    }
 
     public void onerror() {
         if (mErrorListener != null) {
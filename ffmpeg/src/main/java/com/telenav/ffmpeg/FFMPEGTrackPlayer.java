@@ -27,6 +27,7 @@
 
 package com.telenav.ffmpeg;
 
+import java.io.File;
 import java.io.IOException;
 import java.lang.ref.WeakReference;
 import android.content.Context;
@@ -118,6 +119,8 @@ public class FFMPEGTrackPlayer {
 
     private OnInfoListener mOnInfoListener;
 
+    private boolean mPreferProxy = true;
+
     /**
      * Default constructor. Consider using one of the create() methods for
      * synchronously instantiating a MediaPlayer from a Uri or resource.
@@ -205,8 +208,37 @@ public class FFMPEGTrackPlayer {
         updateSurfaceScreenOn();
     }
 
+    /**
+     * Plays the given video files in sequence. When every one of them has a proxy, see {@link FFMPEG#getProxyPath(String)},
+     * the proxies are played instead, unless {@link #setPreferProxy(boolean)} turned that off.
+     */
     public void setDataSource(String[] path) throws IOException, IllegalArgumentException, SecurityException, IllegalStateException {
-        _setDataSource(path);
+        _setDataSource(mPreferProxy ? proxies(path) : path);
+    }
+
+    /**
+     * @param preferProxy if true, the default, the low resolution proxies of the files are played when they all have one,
+     * which is much cheaper than the full resolution frames for a small view
+     */
+    public void setPreferProxy(boolean preferProxy) {
+        mPreferProxy = preferProxy;
+    }
+
+    /** The proxies of the files, or the files themselves if any of them has none. */
+    private static String[] proxies(String[] paths) {
+        if (paths == null || paths.length == 0) {
+            return paths;
+        }
+        String[] proxies = new String[paths.length];
+        for (int i = 0; i < paths.length; i++) {
+            // the frame indexes match, the encoder removes a proxy which lost a frame; mixing sizes within a sequence
+            // would resize the view from file to file
+            if (paths[i] == null || !new File(FFMPEG.getProxyPath(paths[i])).isFile()) {
+                return paths;
+            }
+            proxies[i] = FFMPEG.getProxyPath(paths[i]);
+        }
+        return proxies;
     }
 
     /**
@@ -471,6 +503,13 @@ public class FFMPEGTrackPlayer {
 
     public native void setBackwards(boolean backwards);
 
+    /**
+     * Sets how many packets are read ahead of the decoder, clipped to the size of the packet queue. More smooths
+     * out slow reads, fewer makes seeking and stepping backwards cheaper.
+     * @param packets the read ahead depth, 1 by default
+     */
+    public native void setReadAhead(int packets);
+
     public void initSignalHandler() {
         _initSignalHandler();
     }
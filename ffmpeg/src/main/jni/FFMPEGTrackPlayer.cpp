@@ -28,6 +28,7 @@
 #include <assert.h>
 #include "android/log.h"
 #include "mediaplayer.h"
+#include "native_log.h"
 
 
 
@@ -402,6 +403,16 @@ com_telenav_ffmpeg_FFMPEGTrackPlayer_seeking(JNIEnv *env, jobject thiz, jboolean
     process_media_player_call(env, thiz, mp->seeking(started), NULL, NULL);
 }
 
+static void
+com_telenav_ffmpeg_FFMPEGTrackPlayer_setReadAhead(JNIEnv *env, jobject thiz, jint packets) {
+    MediaPlayer *mp = getMediaPlayer(env, thiz);
+    if (mp == NULL) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call(env, thiz, mp->setReadAhead(packets), NULL, NULL);
+}
+
 static void
 com_telenav_ffmpeg_FFMPEGTrackPlayer_setBackwards(JNIEnv *env, jobject thiz, jboolean backwards) {
     MediaPlayer *mp = getMediaPlayer(env, thiz);
@@ -433,13 +444,10 @@ com_telenav_ffmpeg_FFMPEGTrackPlayer_reset(JNIEnv *env, jobject thiz) {
     process_media_player_call(env, thiz, mp->reset(), NULL, NULL);
 }
 
+static NativeLog *player_log;
+
 void custom_player_log(void *ptr, int level, const char *fmt, va_list vl) {
-    FILE *fp = fopen("/storage/emulated/0/Android/data/com.telenav.streetview/files/av_player_log.txt", "a+");
-    if (fp) {
-        vfprintf(fp, fmt, vl);
-        fflush(fp);
-        fclose(fp);
-    }
+    native_log_vprintf(player_log, level, fmt, vl);
 }
 
 // This function gets some field IDs, which in turn causes class initialization.
@@ -467,6 +475,10 @@ com_telenav_ffmpeg_FFMPEGTrackPlayer_native_init(JNIEnv *env) {
     if (fields.surface_texture == NULL) {
         return;
     }
+    if (!player_log) {
+        player_log = native_log_create("/storage/emulated/0/Android/data/com.telenav.streetview/files/av_player_log.txt",
+                                       NATIVE_LOG_MAX_SIZE);
+    }
     av_log_set_callback(custom_player_log);
     // Initialize libavformat and register all the muxers, demuxers and protocols.
     av_register_all();
@@ -549,6 +561,7 @@ static JNINativeMethod gMethods[] = {
         {       "stepFrame",                "(Z)V",                                       (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_stepFrame},
         {       "seeking",                  "(Z)V",                                       (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_seeking},
         {       "setBackwards",             "(Z)V",                                       (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_setBackwards},
+        {       "setReadAhead",             "(I)V",                                       (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_setReadAhead},
         {       "isLooping",                "()Z",                                        (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_isLooping},
         {       "_release",                 "()V",                                        (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_release},
         {       "_reset",                   "()V",                                        (void *) com_telenav_ffmpeg_FFMPEGTrackPlayer_reset},
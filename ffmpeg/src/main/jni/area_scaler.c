@@ -0,0 +1,174 @@
+#include "area_scaler.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#define AREA_SCALER_MAX_RATIO 15     // at most 16 taps
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AREA_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AREA_SSE2 1
+#endif
+
+static void area_filter_uninit(AreaFilter *f) {
+    av_freep(&f->offsets);
+    av_freep(&f->weights);
+}
+
+static int area_filter_init(AreaFilter *f, int src_size, int dst_size) {
+    double ratio = (double) src_size / dst_size;
+    int i, t;
+    f->taps = (int) ceil(ratio) + 1;
+    f->offsets = av_malloc_array((size_t) dst_size, sizeof(int));
+    f->weights = av_malloc_array((size_t) dst_size * f->taps, sizeof(uint16_t));
+    if (!f->offsets || !f->weights) {
+        area_filter_uninit(f);
+        return -1;
+    }
+    for (i = 0; i < dst_size; i++) {
+        double start = i * ratio, end = start + ratio;
+        uint16_t *weights = f->weights + i * f->taps;
+        int first = (int) floor(start), sum = 0, largest = 0;
+        for (t = 0; t < f->taps; t++) {
+            double overlap = FFMIN(end, first + t + 1) - FFMAX(start, first + t);
+            weights[t] = (uint16_t) (overlap > 0 && first + t < src_size ? lrint(overlap / ratio * 256) : 0);
+            sum += weights[t];
+            largest = weights[t] > weights[largest] ? t : largest;
+        }
+        // the rounding error goes to the sample with the most weight, so a flat area stays flat
+        weights[largest] += 256 - sum;
+        f->offsets[i] = first;
+    }
+    return 0;
+}
+
+/* dst = sum of weights[t] * rows[t], the taps with no weight were left out by the caller. */
+static void blend_rows(const uint8_t **rows, const uint16_t *weights, int count, uint8_t *dst, int width) {
+    int i = 0, t;
+#if defined(AREA_NEON)
+    for (; i + 8 <= width; i += 8) {
+        uint16x8_t acc = vdupq_n_u16(128);
+        for (t = 0; t < count; t++) {
+            acc = vmlaq_n_u16(acc, vmovl_u8(vld1_u8(rows[t] + i)), weights[t]);
+        }
+        vst1_u8(dst + i, vshrn_n_u16(acc, 8));
+    }
+#elif defined(AREA_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= width; i += 16) {
+        __m128i lo = _mm_set1_epi16(128), hi = lo;
+        for (t = 0; t < count; t++) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (rows[t] + i));
+            __m128i w = _mm_set1_epi16((short) weights[t]);
+            // the weights sum to 256, every partial sum fits in 16 bits
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w));
+        }
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#endif
+    for (; i < width; i++) {
+        int sum = 128;
+        for (t = 0; t < count; t++) {
+            sum += rows[t][i] * weights[t];
+        }
+        dst[i] = (uint8_t) (sum >> 8);
+    }
+}
+
+static void resample_row(const AreaFilter *f, const uint8_t *src, int src_width, uint8_t *dst, int dst_width) {
+    int i, t;
+    for (i = 0; i < dst_width; i++) {
+        const uint16_t *weights = f->weights + i * f->taps;
+        int first = f->offsets[i], sum = 128;
+        for (t = 0; t < f->taps; t++) {
+            sum += src[FFMIN(first + t, src_width - 1)] * weights[t];
+        }
+        dst[i] = (uint8_t) (sum >> 8);
+    }
+}
+
+static void scale_plane(AreaScaler *s, int chroma, const uint8_t *src, int src_stride, int src_width, int src_height,
+                        uint8_t *dst, int dst_stride, int dst_width, int dst_height) {
+    const AreaFilter *v = &s->vertical[chroma];
+    const uint8_t *rows[AREA_SCALER_MAX_RATIO + 1];
+    uint16_t weights[AREA_SCALER_MAX_RATIO + 1];
+    int y, t;
+    for (y = 0; y < dst_height; y++) {
+        const uint16_t *w = v->weights + y * v->taps;
+        int count = 0;
+        for (t = 0; t < v->taps && count < FF_ARRAY_ELEMS(rows); t++) {
+            if (w[t]) {
+                rows[count] = src + (int64_t) (v->offsets[y] + t) * src_stride;
+                weights[count++] = w[t];
+            }
+        }
+        blend_rows(rows, weights, count, s->row, src_width);
+        resample_row(&s->horizontal[chroma], s->row, src_width, dst + (int64_t) y * dst_stride, dst_width);
+    }
+}
+
+AreaScaler *area_scaler_create(int src_width, int src_height, int dst_width, int dst_height) {
+    int i;
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0 ||
+        src_width > AREA_SCALER_MAX_RATIO * dst_width || src_height > AREA_SCALER_MAX_RATIO * dst_height) {
+        return NULL;
+    }
+    AreaScaler *s = av_mallocz(sizeof(AreaScaler));
+    if (!s) {
+        return NULL;
+    }
+    s->src_width = src_width;
+    s->src_height = src_height;
+    s->dst_width = dst_width;
+    s->dst_height = dst_height;
+    for (i = 0; i < 2; i++) {
+        if (area_filter_init(&s->horizontal[i], AV_CEIL_RSHIFT(src_width, i), AV_CEIL_RSHIFT(dst_width, i)) < 0 ||
+            area_filter_init(&s->vertical[i], AV_CEIL_RSHIFT(src_height, i), AV_CEIL_RSHIFT(dst_height, i)) < 0) {
+            area_scaler_free(&s);
+            return NULL;
+        }
+    }
+    s->row = av_malloc((size_t) src_width);
+    if (!s->row) {
+        area_scaler_free(&s);
+    }
+    return s;
+}
+
+void area_scaler_free(AreaScaler **ps) {
+    int i;
+    AreaScaler *s = *ps;
+    if (!s) {
+        return;
+    }
+    for (i = 0; i < 2; i++) {
+        area_filter_uninit(&s->horizontal[i]);
+        area_filter_uninit(&s->vertical[i]);
+    }
+    av_freep(&s->row);
+    av_freep(ps);
+}
+
+int area_scaler_matches(AreaScaler *s, int src_width, int src_height, int dst_width, int dst_height) {
+    return s && s->src_width == src_width && s->src_height == src_height && s->dst_width == dst_width && s->dst_height == dst_height;
+}
+
+int area_scale_frame(AreaScaler *s, const AVFrame *src, AVFrame *dst) {
+    int i;
+    if (src->width != s->src_width || src->height != s->src_height || dst->width != s->dst_width || dst->height != s->dst_height) {
+        return -1;
+    }
+    for (i = 0; i < 3; i++) {
+        int chroma = i > 0;
+        scale_plane(s, chroma, src->data[i], src->linesize[i], AV_CEIL_RSHIFT(src->width, chroma), AV_CEIL_RSHIFT(src->height, chroma),
+                    dst->data[i], dst->linesize[i], AV_CEIL_RSHIFT(dst->width, chroma), AV_CEIL_RSHIFT(dst->height, chroma));
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef AREA_SCALER_H_
+#define AREA_SCALER_H_
+
+#include <stdint.h>
+
+#include "libavutil/frame.h"
+
+/*
+ * Weights of one dimension: every destination sample is the average of the source samples it covers,
+ * the ones at its edges counted for the part they overlap it.
+ */
+typedef struct AreaFilter {
+    int taps;
+    int *offsets;           // first source sample of every destination sample
+    uint16_t *weights;      // taps per destination sample, in 1/256, summing to 256
+} AreaFilter;
+
+/*
+ * Downscales YUV420P frames of one size to another by area averaging, what is left to do after the
+ * jpeg decoder scaled the picture by a power of two. The rows are blended with NEON or SSE2, then
+ * every row is resampled with the precomputed weights.
+ */
+typedef struct AreaScaler {
+    int src_width;
+    int src_height;
+    int dst_width;
+    int dst_height;
+    AreaFilter horizontal[2];   // luma, chroma
+    AreaFilter vertical[2];
+    uint8_t *row;               // one blended source row
+} AreaScaler;
+
+AreaScaler *area_scaler_create(int src_width, int src_height, int dst_width, int dst_height);
+void area_scaler_free(AreaScaler **ps);
+
+int area_scaler_matches(AreaScaler *s, int src_width, int src_height, int dst_width, int dst_height);
+
+/* Scales src into dst, whose size and buffers are set. Both are planar 4:2:0. */
+int area_scale_frame(AreaScaler *s, const AVFrame *src, AVFrame *dst);
+
+#endif /* AREA_SCALER_H_ */
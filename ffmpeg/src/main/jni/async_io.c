@@ -0,0 +1,271 @@
+#include "async_io.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#define ASYNC_IO_AVIO_BUFFER_SIZE 32768
+
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+
+typedef struct AsyncBuffer {
+    uint8_t *data;
+    int size;
+    int64_t offset;
+} AsyncBuffer;
+
+/*
+ * The muxer fills buffers[windex] while the io thread writes the pending ones from rindex,
+ * oldest first.
+ */
+typedef struct AsyncWriter {
+    int fd;
+    AsyncBuffer buffers[ASYNC_IO_BUFFERS];
+    int rindex;
+    int windex;             // muxer only
+    int pending;
+    int stop;
+    int error;              // first write error of the io thread, as an AVERROR
+    int64_t pos;            // muxer position
+    int64_t end;            // logical size of the file
+    int preallocated;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t tid;
+} AsyncWriter;
+
+typedef int (*fallocate_fn)(int fd, int mode, int64_t offset, int64_t len);
+
+/* fallocate64 only exists from android 21, older devices just skip the preallocation. */
+static int preallocate(int fd, int64_t size) {
+    static fallocate_fn fallocate64_ptr;
+    static int resolved;
+    if (!resolved) {
+        fallocate64_ptr = (fallocate_fn) dlsym(RTLD_DEFAULT, "fallocate64");
+        resolved = 1;
+    }
+    if (!fallocate64_ptr || size <= 0) {
+        return -1;
+    }
+    // keep the size, a truncated file must not end with preallocated zeros
+    return fallocate64_ptr(fd, FALLOC_FL_KEEP_SIZE, 0, size);
+}
+
+static int write_fully(int fd, const uint8_t *data, int size, int64_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, (size_t) size, (off_t) offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void *io_thread(void *arg) {
+    AsyncWriter *w = arg;
+    for (; ;) {
+        pthread_mutex_lock(&w->mutex);
+        while (!w->pending && !w->stop) {
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        if (!w->pending) {
+            pthread_mutex_unlock(&w->mutex);
+            break;
+        }
+        AsyncBuffer *b = &w->buffers[w->rindex];
+        pthread_mutex_unlock(&w->mutex);
+
+        // a whole buffer per write and per sync, the storage sees few large requests
+        int ret = write_fully(w->fd, b->data, b->size, b->offset);
+        if (ret == 0 && fdatasync(w->fd) < 0) {
+            ret = AVERROR(errno);
+        }
+
+        pthread_mutex_lock(&w->mutex);
+        if (ret < 0 && !w->error) {
+            w->error = ret;
+        }
+        b->size = 0;
+        w->rindex = (w->rindex + 1) % ASYNC_IO_BUFFERS;
+        w->pending--;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    return NULL;
+}
+
+/* Hands the buffer being filled to the io thread, waits for a free one if all of them are pending. */
+static int submit_buffer(AsyncWriter *w) {
+    int ret;
+    pthread_mutex_lock(&w->mutex);
+    if (w->buffers[w->windex].size > 0) {
+        w->windex = (w->windex + 1) % ASYNC_IO_BUFFERS;
+        w->pending++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    while (w->pending == ASYNC_IO_BUFFERS) {
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    ret = w->error;
+    pthread_mutex_unlock(&w->mutex);
+    return ret;
+}
+
+static int write_packet(void *opaque, uint8_t *buf, int buf_size) {
+    AsyncWriter *w = opaque;
+    int written = 0;
+    while (written < buf_size) {
+        AsyncBuffer *b = &w->buffers[w->windex];
+        if (b->size > 0 && b->offset + b->size != w->pos) {
+            // the muxer seeked, the rest goes into a buffer of its own
+            int ret = submit_buffer(w);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+        if (b->size == 0) {
+            b->offset = w->pos;
+        }
+        int n = FFMIN(buf_size - written, ASYNC_IO_BUFFER_SIZE - b->size);
+        memcpy(b->data + b->size, buf + written, (size_t) n);
+        b->size += n;
+        written += n;
+        w->pos += n;
+        w->end = FFMAX(w->end, w->pos);
+        if (b->size == ASYNC_IO_BUFFER_SIZE) {
+            int ret = submit_buffer(w);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    return written;
+}
+
+static int64_t seek(void *opaque, int64_t offset, int whence) {
+    AsyncWriter *w = opaque;
+    switch (whence) {
+        case AVSEEK_SIZE:
+            return w->end;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += w->pos;
+            break;
+        case SEEK_END:
+            offset += w->end;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0) {
+        return AVERROR(EINVAL);
+    }
+    w->pos = offset;
+    return offset;
+}
+
+static void writer_free(AsyncWriter **pw) {
+    AsyncWriter *w = *pw;
+    int i;
+    for (i = 0; i < ASYNC_IO_BUFFERS; i++) {
+        av_freep(&w->buffers[i].data);
+    }
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->cond);
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    av_freep(pw);
+}
+
+int async_io_open(AVIOContext **pb, const char *path, int64_t expected_size) {
+    int i;
+    uint8_t *avio_buffer = NULL;
+    AsyncWriter *w = av_mallocz(sizeof(AsyncWriter));
+    if (!w) {
+        return AVERROR(ENOMEM);
+    }
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (w->fd < 0) {
+        int ret = AVERROR(errno);
+        writer_free(&w);
+        return ret;
+    }
+    for (i = 0; i < ASYNC_IO_BUFFERS; i++) {
+        w->buffers[i].data = av_malloc(ASYNC_IO_BUFFER_SIZE);
+        if (!w->buffers[i].data) {
+            goto fail;
+        }
+    }
+    w->preallocated = preallocate(w->fd, expected_size) == 0;
+
+    avio_buffer = av_malloc(ASYNC_IO_AVIO_BUFFER_SIZE);
+    if (!avio_buffer) {
+        goto fail;
+    }
+    *pb = avio_alloc_context(avio_buffer, ASYNC_IO_AVIO_BUFFER_SIZE, 1, w, NULL, write_packet, seek);
+    if (!*pb) {
+        goto fail;
+    }
+    if (pthread_create(&w->tid, NULL, io_thread, w) != 0) {
+        av_freep(pb);
+        goto fail;
+    }
+    return 0;
+
+    fail:
+    av_free(avio_buffer);
+    writer_free(&w);
+    return AVERROR(ENOMEM);
+}
+
+int async_io_flush(AVIOContext *pb) {
+    AsyncWriter *w = pb->opaque;
+    avio_flush(pb);
+    return submit_buffer(w);
+}
+
+int async_io_close(AVIOContext **pb) {
+    AVIOContext *ctx = *pb;
+    if (!ctx) {
+        return 0;
+    }
+    AsyncWriter *w = ctx->opaque;
+    avio_flush(ctx);
+
+    pthread_mutex_lock(&w->mutex);
+    if (w->buffers[w->windex].size > 0) {
+        w->pending++;
+    }
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->tid, NULL);
+
+    int ret = w->error;
+    if (w->preallocated && ftruncate(w->fd, (off_t) w->end) < 0 && !ret) {
+        ret = AVERROR(errno);
+    }
+    writer_free(&w);
+    av_freep(&ctx->buffer);
+    av_freep(pb);
+    return ret;
+}
@@ -0,0 +1,28 @@
+#ifndef ASYNC_IO_H_
+#define ASYNC_IO_H_
+
+#include "libavformat/avio.h"
+
+#define ASYNC_IO_BUFFER_SIZE (1 << 20)
+#define ASYNC_IO_BUFFERS 2
+
+/*
+ * Write only AVIOContext for the muxer. Written bytes are gathered in large buffers which a
+ * dedicated thread writes to the file, so a slow sd card stalls the muxer only once every
+ * buffer is waiting for the storage. The muxer may seek, each buffer keeps its own file offset.
+ *
+ * expected_size, when known, preallocates the file to keep it in one piece on the storage;
+ * the space left over is released when the context is closed.
+ */
+int async_io_open(AVIOContext **pb, const char *path, int64_t expected_size);
+
+/*
+ * Hands everything written so far to the io thread, without waiting for the storage. Used when the
+ * muxer closes a fragment, so a partly filled buffer does not sit in memory until the next one fills.
+ */
+int async_io_flush(AVIOContext *pb);
+
+/* Flushes the context, waits until everything is on the storage and closes the file. */
+int async_io_close(AVIOContext **pb);
+
+#endif /* ASYNC_IO_H_ */
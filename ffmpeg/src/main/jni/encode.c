@@ -1,87 +1,34 @@
-#include "libavcodec/avcodec.h"
-#include "libavformat/avformat.h"
-#include "libavutil/imgutils.h"
+#include "encode.h"
 #include "crashlitics.h"
 #include "crash_handler.h"
-
-#include <jni.h>
-#include <libswscale/swscale.h>
-#include <libavutil/opt.h>
-
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
-
-#ifdef ANDROID
-#include <android/log.h>
-#include "crash_handler.h"
-#define LOGE(format, ...)  __android_log_print(ANDROID_LOG_ERROR, "FFMPEG E ", format, ##__VA_ARGS__)
-#define LOGI(format, ...)  __android_log_print(ANDROID_LOG_INFO,  "FFMPEG I ", format, ##__VA_ARGS__)
-#else
-#define LOGE(format, ...)  printf("FFMPEG E " format "\n", ##__VA_ARGS__)
-#define LOGI(format, ...)  printf("FFMPEG I " format "\n", ##__VA_ARGS__)
-#endif
-
-#define FRAME_COUNT_LIMIT 64
-
-AVCodecContext *h264_codec_ctx = NULL;
-AVFrame *yuvframe;
-AVPacket pkt;
-FILE *file;
+#include "encode_pipeline.h"
+#include "yuv_convert.h"
+#include "rotate.h"
+#include "async_io.h"
+#include "native_log.h"
+#include "segment_index.h"
+#include "frame_metadata.h"
+#include "area_scaler.h"
+
+#include <libavutil/avstring.h>
+#include <libavutil/intreadwrite.h>
+#include <pthread.h>
+#include <time.h>
 
 crashlytics_context_t *crashlytics_ctx;
 
-//for jpeg decode
-AVFormatContext *jpg_fmt_ctx;
-AVCodec *jpg_codec;
-AVCodecContext *jpg_codec_ctx;
-AVInputFormat *jpg_inf;
-struct SwsContext *sws_ctx;
-unsigned char *jpg_avbuff;
-AVPacket jpg_pkt;
-unsigned char *jpg_buff;
-int jpg_buff_len;
-int jpg_buff_pos;
-
-//for filtering (rotate)
-const char *filter_rotate_cw = "transpose=clock";
-const char *filter_rotate_ccw = "transpose=cclock";
-const char *filter_flip_vert = "vflip,hflip";
-AVFilterContext *buffersink_ctx;
-AVFilterContext *buffersink_ctx_cc;
-AVFilterContext *buffersink_ctx_flip;
-
-AVFilterContext *buffersrc_ctx;
-AVFilterContext *buffersrc_ctx_cc;
-AVFilterContext *buffersrc_ctx_flip;
-
-AVFilterGraph *filter_graph;
-AVFilterGraph *filter_graph_cc;
-AVFilterGraph *filter_graph_flip;
-
-//for encoding
-AVFormatContext *ofmt_ctx;
-AVStream *video_st;
-AVCodec *pCodec;
-int framecnt = 0;
-int total_framecnt = 0;
 int FPS = 4;
 
-
-//struct sigaction psa, oldPsa;
+#define JPEG_POOL_ALIGN (64 * 1024)   // the jpeg buffers grow by this much
+#define ENCODE_PROXY_CRF 30             // the proxies are for a small view on the phone
 
 
-char *folder_path;
+//struct sigaction psa, oldPsa;
 
-int video_index = -1;
+static NativeLog *recording_log;
 
 void custom_log(void *ptr, int level, const char *fmt, va_list vl) {
-    FILE *fp = fopen("/storage/emulated/0/Android/data/com.telenav.streetview/files/av_recording_log.txt", "a+");
-    if (fp) {
-        vfprintf(fp, fmt, vl);
-        fflush(fp);
-        fclose(fp);
-    }
+    native_log_vprintf(recording_log, level, fmt, vl);
 }
 
 void remove_char(char *str, char c) {
@@ -93,30 +40,16 @@ void remove_char(char *str, char c) {
     *pw = '\0';
 }
 
-int read_packet(void *opaque, uint8_t *buf, int buf_size) {
-    int size = buf_size;
-    if (jpg_buff_len - jpg_buff_pos < buf_size)
-        size = jpg_buff_len - jpg_buff_pos;
-    if (size > 0) {
-        memcpy(buf, jpg_buff + jpg_buff_pos, size);
-        jpg_buff_pos += size;
-    }
-    return size;
-}
-
-int initializeEncoder(const char *out_path, int width, int height) {
-    //output initialize
-    avformat_alloc_output_context2(&ofmt_ctx, NULL, "mp4", out_path);
-    //output encoder initialize
-    pCodec = avcodec_find_encoder(AV_CODEC_ID_H264);
-    if (!pCodec) {
-        LOGE("Can not find encoder!\n");
-        return -1;
+/*
+ * Opens one h264 encoder context, every worker of a session gets the same settings and so the same sps/pps.
+ * The workers number their idr frames on their own, so two idrs in a row can carry the same idr_pic_id.
+ * A crf above 0 replaces the bitrate by that constant quality, for the proxy rendition.
+ */
+static AVCodecContext *open_h264(EncoderSession *s, int width, int height, float crf) {
+    AVCodecContext *h264_codec_ctx = avcodec_alloc_context3(s->pCodec);
+    if (!h264_codec_ctx) {
+        return NULL;
     }
-    if (!ofmt_ctx) {
-        LOGE("Could not create format CTX");
-    }
-    h264_codec_ctx = avcodec_alloc_context3(pCodec);
     h264_codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
     h264_codec_ctx->color_range = AVCOL_RANGE_JPEG;
     h264_codec_ctx->width = width;
@@ -124,13 +57,17 @@ int initializeEncoder(const char *out_path, int width, int height) {
     h264_codec_ctx->time_base.num = 1;
     h264_codec_ctx->time_base.den = FPS;
     h264_codec_ctx->bit_rate = 800000;
-    h264_codec_ctx->gop_size = 0;
-    h264_codec_ctx->i_quant_offset = 0;
-    h264_codec_ctx->i_quant_factor = 0;
+    if (s->options.keyframe_interval > 0) {
+        // p frames in between, the player decodes forward from the previous idr to reach a frame
+        h264_codec_ctx->gop_size = s->options.keyframe_interval;
+    } else {
+        h264_codec_ctx->gop_size = 0;
+        h264_codec_ctx->i_quant_offset = 0;
+        h264_codec_ctx->i_quant_factor = 0;
+    }
     h264_codec_ctx->profile = FF_PROFILE_H264_HIGH;
-    /* Some formats want stream headers to be separate. */
-    if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
-        h264_codec_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    /* mp4 wants the stream headers to be separate, each file gets them in its avcC box */
+    h264_codec_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
 
     //H264 codec param
     //h264_codec_ctx->me_range = 16;
@@ -138,6 +75,12 @@ int initializeEncoder(const char *out_path, int width, int height) {
     h264_codec_ctx->qcompress = 0.6;
     h264_codec_ctx->qmin = 12;
     h264_codec_ctx->qmax = 22;
+    if (s->rate_control.budget_per_km || crf > 0) {
+        // constant quality, changed frame by frame, the qp range has to leave room for it
+        h264_codec_ctx->bit_rate = 0;
+        h264_codec_ctx->qmax = 40;
+        av_opt_set_double(h264_codec_ctx->priv_data, "crf", crf > 0 ? crf : RATE_CONTROL_CRF_DEFAULT, 0);
+    }
     //Optional Param
 //    c->max_b_frames = 3;
     // Set H264 preset and tune
@@ -160,90 +103,165 @@ int initializeEncoder(const char *out_path, int width, int height) {
     av_opt_set(h264_codec_ctx->priv_data, "level", "high", AV_OPT_SEARCH_CHILDREN);
     av_opt_set_dict(h264_codec_ctx->priv_data, &param);
     av_opt_set_dict(h264_codec_ctx, &param);
-    if (avcodec_open2(h264_codec_ctx, pCodec, &param) < 0) {
+    if (s->options.keyframe_interval > 0) {
+        // the forced keyframe starting each file has to be an idr, not just a recovery point
+        av_opt_set(h264_codec_ctx->priv_data, "forced-idr", "1", AV_OPT_SEARCH_CHILDREN);
+    }
+    if (s->encode_workers > 1) {
+        // the frames are spread over the workers, one core each
+        h264_codec_ctx->thread_count = 1;
+    }
+    if (avcodec_open2(h264_codec_ctx, s->pCodec, &param) < 0) {
         LOGE("Failed to open encoder!\n");
+        av_dict_free(&param);
+        avcodec_free_context(&h264_codec_ctx);
+        return NULL;
+    }
+    av_dict_free(&param);
+    return h264_codec_ctx;
+}
+
+/*
+ * Opens the h264 encoder, kept across the segments as long as the frame size does not change.
+ * Every segment gets a copy of its parameters and extradata (sps/pps) for its own stream.
+ * With parallel encoding every worker has its own context, all of them intra only, and
+ * h264_codec_ctx only holds a copy of their parameters, read while the workers are busy.
+ * Their interleaved idrs repeat idr_pic_id, which h264 forbids for consecutive idrs: ffmpeg decodes the
+ * files, a strict or hardware decoder may take two frames for one picture. Off unless asked for.
+ */
+int initializeEncoder(EncoderSession *s, int width, int height) {
+    int i;
+    //output encoder initialize
+    if (!s->pCodec) {
+        s->pCodec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    }
+    if (!s->pCodec) {
+        LOGE("Can not find encoder!\n");
         return -1;
     }
+    if (s->encode_workers == 1) {
+        s->h264_codec_ctx = open_h264(s, width, height, 0);
+        if (!s->h264_codec_ctx) {
+            return -1;
+        }
+    } else {
+        for (i = 0; i < s->encode_workers; i++) {
+            s->worker_ctx[i] = open_h264(s, width, height, 0);
+            if (!s->worker_ctx[i]) {
+                return -1;
+            }
+        }
+        s->h264_codec_ctx = avcodec_alloc_context3(NULL);
+        if (!s->h264_codec_ctx || avcodec_copy_context(s->h264_codec_ctx, s->worker_ctx[0]) < 0) {
+            return -1;
+        }
+    }
+    LOGI("Initialized encoder successfully, height %i, width %i, workers %i\n", height, width, s->encode_workers);
+    return 0;
+}
 
+AVCodecContext *encode_worker_context(EncoderSession *s, int worker) {
+    return s->encode_workers == 1 ? s->h264_codec_ctx : s->worker_ctx[worker];
+}
 
-    //Add a new stream to output,should be called by the user before avformat_write_header() for muxing
-    video_st = avformat_new_stream(ofmt_ctx, pCodec);
-    if (video_st == NULL) {
-        return -1;
+static void close_encoder(EncoderSession *s) {
+    int i;
+    for (i = 0; i < ENCODE_MAX_WORKERS; i++) {
+        avcodec_free_context(&s->worker_ctx[i]);
+    }
+    if (s->h264_codec_ctx) {
+        avcodec_free_context(&s->h264_codec_ctx);
+        LOGI("Closed h264 encoder");
+    }
+}
+
+/*
+ * Starts the sample journal of a segment, once the header gave the stream its final time base.
+ * The recording goes on without it if the journal can not be created.
+ */
+static void open_index(EncoderSegment *seg) {
+    char path[1024];
+    AVCodecContext *codec = seg->video_st->codec;
+    SegmentIndexHeader header = {
+            .width = codec->width,
+            .height = codec->height,
+            .time_base_num = seg->video_st->time_base.num,
+            .time_base_den = seg->video_st->time_base.den,
+            .extradata = codec->extradata,
+            .extradata_size = codec->extradata_size,
+    };
+    segment_index_path(seg->path, path, sizeof(path));
+    seg->index_file = segment_index_create(path, &header);
+    if (!seg->index_file) {
+        LOGE("Could not create sample journal %s", path);
+    }
+}
+
+/* Closes the sample journal of a segment, removing it when the file does not need a repair. */
+static void close_index(EncoderSegment *seg, int remove_file) {
+    char path[1024];
+    if (!seg->index_file) {
+        return;
+    }
+    fclose(seg->index_file);
+    seg->index_file = NULL;
+    if (remove_file) {
+        segment_index_path(seg->path, path, sizeof(path));
+        remove(path);
     }
-    video_st->time_base.num = 1;
-    video_st->time_base.den = FPS;
-    video_st->codec = h264_codec_ctx;
+}
 
+/*
+ * Opens the output file of a segment and writes its header, done by the mux stage on the segment's first frame.
+ * In fragmented mode the header is an empty moov, the samples are indexed by the fragments written later.
+ */
+static int open_output(EncoderSession *s, EncoderSegment *seg) {
+    AVCodecContext *codec = seg->video_st->codec;
+    // about a quarter of a byte per pixel at the quality range of the encoder
+    int64_t expected_size = (int64_t) FRAME_COUNT_LIMIT * codec->width * codec->height / 4;
     //Open output URL,set before avformat_write_header() for muxing
-    if (avio_open(&ofmt_ctx->pb, out_path, AVIO_FLAG_READ_WRITE) < 0) {
+    //written by the io thread of the segment, so the storage latency does not hold up the mux stage
+    if (async_io_open(&seg->ofmt_ctx->pb, seg->path, expected_size) < 0) {
         LOGE("Failed to open output file!\n");
         return -1;
     }
+    seg->ofmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    if (seg->start_time >= 0) {
+        // the mvhd keeps whole seconds, the frame times are exact relative to it
+        char creation_time[32];
+        struct tm tm;
+        time_t start = (time_t) (seg->start_time / 1000);
+        strftime(creation_time, sizeof(creation_time), "%Y-%m-%d %H:%M:%S", gmtime_r(&start, &tm));
+        av_dict_set(&seg->ofmt_ctx->metadata, "creation_time", creation_time, 0);
+    }
+    AVDictionary *opts = NULL;
+    if (s->options.fragment_frames > 0) {
+        av_dict_set(&opts, "movflags", "empty_moov+default_base_moof+frag_custom", 0);
+    }
     //Write File Header
-    if (avformat_write_header(ofmt_ctx, NULL) < 0) {
+    if (avformat_write_header(seg->ofmt_ctx, &opts) < 0) {
         LOGE("Failed to write header to output format context");
     }
-    total_framecnt = 0;
-    framecnt = 0;
-
-    LOGI("Initialized file successfully, height %i, width %i\n", height, width);
+    av_dict_free(&opts);
+    seg->header_written = 1;
+    if (s->options.fragment_frames <= 0 && !seg->proxy) {
+        // a proxy is cheap to lose, only the segment itself is worth a repair
+        open_index(seg);
+    }
+    LOGI("Initialized file successfully %s", seg->path);
     LOGI("----------------------------------------------");
     return 0;
 }
 
-int flush() {
-    int ret;
-    int got_frame;
-    AVPacket enc_pkt;
-    if (!ofmt_ctx || !ofmt_ctx->streams || !ofmt_ctx->streams[0] || !ofmt_ctx->streams[0]->codec || !ofmt_ctx->streams[0]->codec->codec) {
-        return 0;
-    }
-    LOGI("Flushing encoder");
-    LOGI("----------------------------------------------");
-    if (!(ofmt_ctx->streams[0]->codec->codec->capabilities & CODEC_CAP_DELAY)) {
-        LOGI("No CODEC_CAP_DELAY compatibility");
-        return 0;
-    }
-    LOGI("trying to flush remaining frames, total = %i, written %i", total_framecnt, framecnt);
-    while (total_framecnt > framecnt) {
-        enc_pkt.data = NULL;
-        enc_pkt.size = 0;
-        av_init_packet(&enc_pkt);
-        ret = avcodec_encode_video2(ofmt_ctx->streams[0]->codec, &enc_pkt,
-                                    NULL, &got_frame);
-        LOGI("flushing frame code %i", ret);
-        if (ret < 0)
-            LOGE("error flushing frame");
-        break;
-        if (!got_frame) {
-            ret = 0;
-            LOGI("obtained no frame");
-            break;
-        }
-        framecnt++;
-        enc_pkt.stream_index = video_st->index;
-
-        AVRational time_base = ofmt_ctx->streams[0]->time_base;
-        AVRational time_base_q = {1, AV_TIME_BASE};
-        int64_t calc_duration = (int64_t) ((double) (AV_TIME_BASE) / (double) FPS);
-        enc_pkt.pts = av_rescale_q(framecnt * calc_duration, time_base_q, time_base);
-        enc_pkt.dts = enc_pkt.pts;
-        enc_pkt.duration = av_rescale_q(calc_duration, time_base_q, time_base);
-        enc_pkt.pos = -1;
-        ofmt_ctx->duration = enc_pkt.duration * framecnt;
-        /* mux encoded frame */
-        if (ofmt_ctx && ofmt_ctx->streams && ofmt_ctx->streams[0]) {
-            ret = av_interleaved_write_frame(ofmt_ctx, &enc_pkt);
-        } else {
-            ret = -1;
-        }
-        if (ret < 0)
-            break;
-        LOGI("Flush Encoder: Succeed to encode 1 frame!\tsize:%5d\n", enc_pkt.size);
-    }
+/*
+ * Finalizes the file of a segment. The encoder runs without delay (zerolatency tune, no b-frames),
+ * every packet of the segment was written by the mux stage already, so only the trailer is left.
+ */
+int flush(EncoderSegment *seg) {
+    AVFormatContext *ofmt_ctx = seg->ofmt_ctx;
+    LOGI("Closing file %s, total = %i, written %i", seg->path, seg->total_framecnt, seg->framecnt);
     //Write file trailer
-    if (ofmt_ctx && ofmt_ctx->pb && framecnt > 0) {
+    if (ofmt_ctx && ofmt_ctx->pb && seg->framecnt > 0 && !seg->failed) {
         int retval = av_write_trailer(ofmt_ctx);
         LOGI("Writing file trailer %i", retval);
         if (retval < 0) {
@@ -251,8 +269,12 @@ int flush() {
             av_strerror(retval, (char *) &arr, 200);
             LOGE("Error while writing file trailer: %s", (char *) &arr);
         }
+        // the journal is kept for a later repair if the trailer could not be written
+        close_index(seg, retval >= 0);
     }
-    if (total_framecnt == 0 && framecnt == 0 && ofmt_ctx) {
+    // a proxy with a missing frame would not match the frame indexes of its segment, the player falls back to the segment
+    if ((seg->framecnt == 0 || seg->failed) && ofmt_ctx && ofmt_ctx->pb) {
+        close_index(seg, 1);
         LOGI("entered remove file");
         remove(ofmt_ctx->filename);
         LOGI("finished remove file");
@@ -260,541 +282,1433 @@ int flush() {
     return 0;
 }
 
-int nextFile(jint width, jint height) {
-    flush();
-    char *out_path = (char *) malloc(1024);
-    video_index++;
-    int ret = video_index;
-    sprintf(out_path, "%s%i.mp4\0", folder_path, video_index);
-    remove_char(out_path, 11);//removing vertical tab
-    LOGI("Creating new file %s", out_path);
-    if (sws_ctx) {
-        sws_freeContext(sws_ctx);
-        sws_ctx = NULL;
+/* Closes the output file of a segment, then frees it. */
+static void free_segment(EncoderSegment **pseg) {
+    EncoderSegment *seg = *pseg;
+    if (!seg) {
+        return;
     }
+    close_index(seg, 0);
+    if (seg->ofmt_ctx) {
+        if (seg->ofmt_ctx->streams && seg->ofmt_ctx->pb && async_io_close(&seg->ofmt_ctx->pb) < 0) {
+            LOGE("Error while writing %s", seg->path);
+        }
+        avformat_free_context(seg->ofmt_ctx);
+    }
+    av_freep(pseg);
+}
 
+/* Flushes and closes a segment once no more frames will be written to it. */
+static void finish_segment(EncoderSegment **pseg) {
+    if (*pseg) {
+        flush(*pseg);
+        free_segment(pseg);
+    }
+}
 
-    if (h264_codec_ctx) {
-        if (h264_codec_ctx->codec && h264_codec_ctx->codec == pCodec) {
-            if (!h264_codec_ctx->codec || !h264_codec_ctx->codec->name) {
-                LOGE("'kali crash codec is null while releasing");
-            }
-            avcodec_close(h264_codec_ctx);
-        } else {
-            LOGE("Codecs are not the same withing context");
-        }
+/* Creates the muxer of a segment encoded with the given context, the file is opened by the mux stage. */
+static EncoderSegment *create_segment(EncoderSession *s, AVCodecContext *codec, int index, int proxy) {
+    EncoderSegment *seg = av_mallocz(sizeof(EncoderSegment));
+    if (!seg) {
+        return NULL;
     }
-    h264_codec_ctx = NULL;
+    seg->index = index;
+    seg->proxy = proxy;
+    snprintf(seg->path, sizeof(seg->path), "%s%i%s.mp4", s->folder_path, index, proxy ? ".proxy" : "");
+    remove_char(seg->path, 11);//removing vertical tab
+    LOGI("Creating new file %s", seg->path);
 
-    if (ofmt_ctx) {
-//        if (ofmt_ctx->filename && strlen(ofmt_ctx->filename) != 0) {
-//            free(ofmt_ctx->filename);
-//        }
-        if (ofmt_ctx->streams && ofmt_ctx->pb) {
-            avio_close(ofmt_ctx->pb);
-        }
-        avformat_free_context(ofmt_ctx);
-        ofmt_ctx = NULL;
-        LOGI("KALI setting null ofmtcontext at nextfile");
+    //output initialize
+    avformat_alloc_output_context2(&seg->ofmt_ctx, NULL, "mp4", seg->path);
+    if (!seg->ofmt_ctx) {
+        LOGE("Could not create format CTX");
+        free_segment(&seg);
+        return NULL;
     }
-    int res = initializeEncoder(out_path, width, height);
-    if (res < 0) {
-        ret = res;
+    //Add a new stream to output,should be called by the user before avformat_write_header() for muxing
+    seg->video_st = avformat_new_stream(seg->ofmt_ctx, s->pCodec);
+    if (seg->video_st == NULL || avcodec_copy_context(seg->video_st->codec, codec) < 0) {
+        LOGE("Could not create output stream");
+        free_segment(&seg);
+        return NULL;
     }
-    return ret;
+    // milliseconds, the frames are spaced as they were captured
+    seg->video_st->time_base.num = 1;
+    seg->video_st->time_base.den = 1000;
+    seg->video_st->codec->codec_tag = 0;
+    return seg;
 }
 
-static int init_filter(AVFilterGraph **filt_graph, AVFilterContext **bufsink_ctx, AVFilterContext **bufsrc_ctx, const char *filters_descr) {
-    LOGI("Initializing filter %s", filters_descr);
-    char args[512];
-    int ret = 0;
-    AVFilterGraph *filter_graph = *filt_graph;
-    AVFilterContext *buffersink_ctx = *bufsink_ctx;
-    AVFilterContext *buffersrc_ctx = *bufsrc_ctx;
-    AVFilter *buffersrc = avfilter_get_by_name("buffer");
-    AVFilter *buffersink = avfilter_get_by_name("buffersink");
-    AVFilterInOut *outputs = avfilter_inout_alloc();
-    AVFilterInOut *inputs = avfilter_inout_alloc();
-    AVRational time_base = jpg_fmt_ctx->streams[0]->time_base;
-    enum AVPixelFormat pix_fmts[] = {jpg_codec_ctx->pix_fmt, AV_PIX_FMT_NONE};
-
-    filter_graph = avfilter_graph_alloc();
-    if (!outputs || !inputs || !filter_graph) {
-        ret = AVERROR(ENOMEM);
-        goto end;
-    }
-
-    /* buffer video source: the decoded frames from the decoder will be inserted here. */
-    snprintf(args, sizeof(args),
-             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-             jpg_codec_ctx->width, jpg_codec_ctx->height, jpg_codec_ctx->pix_fmt,
-             time_base.num, time_base.den,
-             jpg_codec_ctx->sample_aspect_ratio.num, jpg_codec_ctx->sample_aspect_ratio.den);
-
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in",
-                                       args, NULL, filter_graph);
-    if (ret < 0) {
-        LOGE("Cannot create buffer source");
-        goto end;
+/*
+ * Creates the muxer of the next segment for the current encoder. The previous segment stays alive
+ * until the mux stage has written its last frame, as there can still be jobs for it in the queues.
+ */
+EncoderSegment *nextFile(EncoderSession *s) {
+    EncoderSegment *seg = create_segment(s, s->h264_codec_ctx, s->video_index + 1, 0);
+    if (!seg) {
+        return NULL;
     }
+    s->video_index++;
+    s->enc_segment = seg;
+    return seg;
+}
 
-    /* buffer video sink: to terminate the filter chain. */
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
-                                       NULL, NULL, filter_graph);
-    if (ret < 0) {
-        LOGE("Cannot create buffer sink");
-        goto end;
+/* Clockwise rotation, in degrees, needed to display a frame with the given exif orientation. */
+static int orientation_to_degrees(int orientation) {
+    switch (orientation) {
+        case 6:
+            return 90;
+        case 3:
+            return 180;
+        case 8:
+            return 270;
+        default:
+            return 0;
     }
+}
 
-    ret = av_opt_set_int_list(buffersink_ctx, "pix_fmts", pix_fmts,
-                              AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
-    if (ret < 0) {
-        LOGE("Cannot set output pixel format");
-        goto end;
-    }
-
-    /*
-     * Set the endpoints for the filter graph. The filter_graph will
-     * be linked to the graph described by filters_descr.
-     */
-
-    /*
-     * The buffer source output must be connected to the input pad of
-     * the first filter described by filters_descr; since the first
-     * filter input label is not specified, it is set to "in" by
-     * default.
-     */
-    outputs->name = av_strdup("in");
-    outputs->filter_ctx = buffersrc_ctx;
-    outputs->pad_idx = 0;
-    outputs->next = NULL;
-
-    /*
-     * The buffer sink input must be connected to the output pad of
-     * the last filter described by filters_descr; since the last
-     * filter output label is not specified, it is set to "out" by
-     * default.
-     */
-    inputs->name = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
-    inputs->pad_idx = 0;
-    inputs->next = NULL;
-
-    if ((ret = avfilter_graph_parse_ptr(filter_graph, filters_descr,
-                                        &inputs, &outputs, NULL)) < 0)
-        goto end;
-
-    if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
-        goto end;
-
-    end:
-    if (inputs) {
-        avfilter_inout_free(&inputs);
-    }
-    if (outputs) {
-        avfilter_inout_free(&outputs);
+/*
+ * Prepends an h264 display orientation SEI (payload type 47) to an annex b packet, so the orientation
+ * can change from frame to frame inside one track; the track header only holds the first one.
+ * The upright orientation is written as a half turn plus both flips, the decoder only exports
+ * the orientation of a frame when it differs from the identity in at least one field.
+ */
+static int add_orientation_sei(AVPacket *pkt, int orientation) {
+    int degrees = orientation_to_degrees(orientation);
+    int hflip = degrees == 0;
+    int vflip = degrees == 0;
+    // counter clockwise, in units of 1/65536 of a turn
+    int anticlockwise = ((360 - (degrees ? degrees : 180)) % 360) * 65536 / 360;
+    // cancel flag, flips, rotation, repetition period ue(0), extension flag, then payload alignment
+    uint8_t payload[] = {
+            (uint8_t) ((hflip << 6) | (vflip << 5) | (anticlockwise >> 11)),
+            (uint8_t) ((anticlockwise >> 3) & 0xff),
+            (uint8_t) (((anticlockwise & 7) << 5) | 0x14),
+    };
+    return frame_metadata_add_sei(pkt, 47, payload, sizeof(payload));
+}
+
+/* A cleared job, one the session recycled when it has any. */
+static EncodeJob *take_job(EncoderSession *s) {
+    AVFrame *spare_frames[2];
+    pthread_mutex_lock(&s->pool_mutex);
+    EncodeJob *job = s->free_jobs;
+    if (job) {
+        s->free_jobs = job->next_free;
+        s->nb_free_jobs--;
     }
-    if (ret < 0) {
-        if (filter_graph) {
-            avfilter_graph_free(&filter_graph);
+    pthread_mutex_unlock(&s->pool_mutex);
+    if (job) {
+        memcpy(spare_frames, job->spare_frames, sizeof(spare_frames));
+        memset(job, 0, sizeof(EncodeJob));
+        memcpy(job->spare_frames, spare_frames, sizeof(spare_frames));
+    } else {
+        job = av_mallocz(sizeof(EncodeJob));
+        if (!job) {
+            return NULL;
         }
-//        if (buffersink_ctx) {
-//            avfilter_free(buffersink_ctx);
-//        }
-//        if (buffersrc_ctx) {
-//            avfilter_free(buffersrc_ctx);
-//        }
     }
-    if (filter_graph) {
-        *(filt_graph) = filter_graph;
-        *(bufsink_ctx) = buffersink_ctx;
-        *(bufsrc_ctx) = buffersrc_ctx;
+    job->session = s;
+    return job;
+}
+
+/* A buffer for a copy of a jpeg of size bytes and its padding. */
+static AVBufferRef *get_jpeg_buffer(EncoderSession *s, int size) {
+    AVBufferRef *buf = NULL;
+    pthread_mutex_lock(&s->pool_mutex);
+    if (size + AV_INPUT_BUFFER_PADDING_SIZE > s->jpeg_pool_size) {
+        // the buffers still out keep the old pool alive until they are released
+        av_buffer_pool_uninit(&s->jpeg_pool);
+        s->jpeg_pool_size = FFALIGN(size + AV_INPUT_BUFFER_PADDING_SIZE, JPEG_POOL_ALIGN);
+        s->jpeg_pool = av_buffer_pool_init(s->jpeg_pool_size, av_buffer_alloc);
+        if (!s->jpeg_pool) {
+            s->jpeg_pool_size = 0;
+        }
     }
-    return ret;
+    if (s->jpeg_pool) {
+        buf = av_buffer_pool_get(s->jpeg_pool);
+    }
+    pthread_mutex_unlock(&s->pool_mutex);
+    return buf;
 }
 
+/* An empty frame, one of the job's spares when it has any. */
+static AVFrame *job_frame(EncodeJob *job) {
+    int i;
+    for (i = 0; i < FF_ARRAY_ELEMS(job->spare_frames); i++) {
+        if (job->spare_frames[i]) {
+            AVFrame *frame = job->spare_frames[i];
+            job->spare_frames[i] = NULL;
+            return frame;
+        }
+    }
+    return av_frame_alloc();
+}
 
-int filter(int rotation) {
+/* Unreferences the frame and keeps it as a spare of the job. */
+static void job_release_frame(EncodeJob *job, AVFrame **frame) {
+    int i;
+    if (!*frame) {
+        return;
+    }
+    av_frame_unref(*frame);
+    for (i = 0; i < FF_ARRAY_ELEMS(job->spare_frames); i++) {
+        if (!job->spare_frames[i]) {
+            job->spare_frames[i] = *frame;
+            *frame = NULL;
+            return;
+        }
+    }
+    av_frame_free(frame);
+}
 
-    int ret_val;
-    AVFilterGraph *filt_graph;
-    AVFilterContext *buf_src_ctx;
-    AVFilterContext *buf_sink_ctx;
-    const char *filter_type;
-    switch (rotation) {
-        case 6:
-            LOGI("Selecting cw rotate filter");
-            filt_graph = filter_graph;
-            buf_sink_ctx = buffersink_ctx;
-            buf_src_ctx = buffersrc_ctx;
-            filter_type = filter_rotate_cw;
-            break;
+/* Applies the exif orientation of a frame, into a frame taken from the session's pool. */
+int rotate(EncoderSession *s, EncodeJob *job) {
+    AVFrame *src = job->frame;
+    int width = src->width;
+    int height = src->height;
+    switch (job->rotation) {
         case 3:
-            LOGI("Selecting vertical flip filter");
-            filt_graph = filter_graph_flip;
-            buf_sink_ctx = buffersink_ctx_flip;
-            buf_src_ctx = buffersrc_ctx_flip;
-            filter_type = filter_flip_vert;
-            break;
+        case 6:
         case 8:
-            LOGI("Selecting ccw rotate filter");
-            filt_graph = filter_graph_cc;
-            buf_sink_ctx = buffersink_ctx_cc;
-            buf_src_ctx = buffersrc_ctx_cc;
-            filter_type = filter_rotate_ccw;
             break;
         case 1:
         default:
             LOGI("No need to rotate");
             return 0;
     }
-    if (!filt_graph) {
-        if ((init_filter(&filt_graph, &buf_sink_ctx, &buf_src_ctx, filter_type)) < 0) {
-            LOGE("Filter init failed");
-            return -1;
+    if (rotate_swaps_dimensions(job->rotation)) {
+        width = src->height;
+        height = src->width;
+    }
+    if (frame_pool_ensure(&s->rotate_pool, (enum AVPixelFormat) src->format, width, height) < 0) {
+        LOGE("Could not create rotation frame pool");
+        return -1;
+    }
+    int64_t start = encoder_stats_now();
+    AVFrame *rotated = job_frame(job);
+    if (!rotated || frame_pool_get_buffer(s->rotate_pool, rotated) < 0) {
+        job_release_frame(job, &rotated);
+        return -1;
+    }
+    av_frame_copy_props(rotated, src);
+    rotate_frame(src, rotated, job->rotation);
+    job_release_frame(job, &job->frame);
+    job->frame = rotated;
+    encoder_stats_record_since(&s->stats, ENCODER_STATS_ROTATE, start);
+    LOGI("Applied rotation %i", job->rotation);
+    return 0;
+}
+
+EncodeJob *encode_job_create(EncoderSession *s, AVBufferRef *buf, int offset, int size) {
+    EncodeJob *job = take_job(s);
+    if (!job) {
+        return NULL;
+    }
+    if (buf) {
+        job->jpeg_buf = av_buffer_ref(buf);
+    } else if (size > 0) {
+        offset = 0;
+        job->jpeg_buf = get_jpeg_buffer(s, size);
+        if (job->jpeg_buf) {
+            memset(job->jpeg_buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        }
+    }
+    if (size > 0 && !job->jpeg_buf) {
+        encode_job_free(&job);
+        return NULL;
+    }
+    if (job->jpeg_buf) {
+        job->jpeg = job->jpeg_buf->data + offset;
+        job->jpeg_size = size;
+    }
+    job->ticket = s->next_ticket++;
+    job->rotation = 1;
+    job->capture_time = -1;
+    job->speed = s->rate_control.budget_per_km ? rate_control_speed(&s->rate_control) : -1;
+    pthread_mutex_lock(&s->location_mutex);
+    job->location = s->location;
+    pthread_mutex_unlock(&s->location_mutex);
+    job->video_index = -1;
+    av_init_packet(&job->pkt);
+    job->pkt.data = NULL;
+    job->pkt.size = 0;
+    av_init_packet(&job->proxy_pkt);
+    job->proxy_pkt.data = NULL;
+    job->proxy_pkt.size = 0;
+    return job;
+}
+
+void encode_job_free(EncodeJob **pjob) {
+    EncodeJob *job = *pjob;
+    EncoderSession *s;
+    int i;
+    if (!job) {
+        return;
+    }
+    *pjob = NULL;
+    av_buffer_unref(&job->jpeg_buf);
+    job_release_frame(job, &job->frame);
+    job_release_frame(job, &job->proxy_frame);
+    av_packet_unref(&job->pkt);
+    av_packet_unref(&job->proxy_pkt);
+    s = job->session;
+    pthread_mutex_lock(&s->pool_mutex);
+    if (s->nb_free_jobs < ENCODE_FREE_JOBS) {
+        job->next_free = s->free_jobs;
+        s->free_jobs = job;
+        s->nb_free_jobs++;
+        job = NULL;
+    }
+    pthread_mutex_unlock(&s->pool_mutex);
+    if (job) {
+        for (i = 0; i < FF_ARRAY_ELEMS(job->spare_frames); i++) {
+            av_frame_free(&job->spare_frames[i]);
         }
-        switch (rotation) {
-            case 6:
-                filter_graph = filt_graph;
-                buffersink_ctx = buf_sink_ctx;
-                buffersrc_ctx = buf_src_ctx;
-                break;
-            case 3:
-                filter_graph_flip = filt_graph;
-                buffersink_ctx_flip = buf_sink_ctx;
-                buffersrc_ctx_flip = buf_src_ctx;
-                break;
-            case 8:
-                filter_graph_cc = filt_graph;
-                buffersink_ctx_cc = buf_sink_ctx;
-                buffersrc_ctx_cc = buf_src_ctx;
-                break;
-        }
-    }
-    LOGI("Filtering...");
-    if (av_buffersrc_add_frame_flags(buf_src_ctx, yuvframe, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {//AV_BUFFERSRC_FLAG_PUSH
-        LOGE("Error while feeding the filtergraph");
+        av_free(job);
+    }
+}
+
+static int (*const encode_stages[ENCODE_STAGES])(EncoderSession *, EncodeJob *) = {
+        decode_stage, filter_stage, encode_stage, mux_stage
+};
+
+/*
+ * Runs one stage on a job. A failed job still goes through the remaining stages, every stage
+ * skips it except the mux stage, which has to see every segment to finalize the previous one.
+ */
+void encode_job_run_stage(EncoderSession *s, EncodeJob *job, int stage) {
+    encode_job_set_result(job, encode_stages[stage](s, job));
+}
+
+void encode_job_set_result(EncodeJob *job, int ret) {
+    if (ret < 0) {
+        job->status = ret;
+        job->frame_index = -1;
+    }
+}
+
+/* (Re)opens the jpeg decoder, which scales the pictures down by 2^lowres in the idct. */
+static int open_jpeg_decoder(EncoderSession *s, int lowres) {
+    avcodec_free_context(&s->jpg_codec_ctx);
+    s->jpg_codec_ctx = avcodec_alloc_context3(s->jpg_codec);
+    if (!s->jpg_codec_ctx) {
         return -1;
     }
-    AVFrame *filt_frame = av_frame_alloc();
-    /* pull filtered frames from the filtergraph */
-    while (1) {
-        ret_val = av_buffersink_get_frame(buf_sink_ctx, filt_frame);
-        if (ret_val == AVERROR(EAGAIN) || ret_val == AVERROR_EOF)
-            return 0;// formatCheck;
-        if (ret_val < 0)
-            return -1; //goto formatCheck;
-        if (yuvframe) {
-            av_frame_free(&yuvframe);
-        }
-        yuvframe = filt_frame;
-        break;
-        LOGI("Applied filter");
+    s->jpg_codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    s->jpg_codec_ctx->color_range = AVCOL_RANGE_JPEG;
+    // decoded frames outlive the next decode call once they are queued for the next stage
+    s->jpg_codec_ctx->refcounted_frames = 1;
+    av_codec_set_lowres(s->jpg_codec_ctx, lowres);
+    if (avcodec_open2(s->jpg_codec_ctx, s->jpg_codec, NULL) < 0) {
+        LOGE("Could not open the jpeg decoder with lowres %i", lowres);
+        avcodec_free_context(&s->jpg_codec_ctx);
+        return -1;
     }
     return 0;
 }
 
-int *decodeJpegData(jbyte *jpeg, int length) {
-    jpg_buff_len = length;
-    jpg_buff = (unsigned char *) jpeg;
-    jpg_buff_pos = 0;
-    int *ret = (int *) malloc(2 * sizeof(int));
-    ret[0] = -1;
-    ret[1] = 0;
-    yuvframe = av_frame_alloc();
-    av_init_packet(&jpg_pkt);
+/* Reads the size of a jpeg from its frame header, without decoding it. */
+static int jpeg_dimensions(const uint8_t *data, int size, int *width, int *height) {
+    int i = 2;
+    if (size < 4 || data[0] != 0xff || data[1] != 0xd8) {
+        return -1;
+    }
+    while (i + 4 <= size) {
+        int marker, length;
+        if (data[i] != 0xff) {
+            return -1;
+        }
+        marker = data[i + 1];
+        if (marker == 0xff) {
+            // fill byte
+            i++;
+            continue;
+        }
+        length = AV_RB16(data + i + 2);
+        // every start of frame marker except the dht, jpg and dac ones
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            if (i + 9 > size) {
+                return -1;
+            }
+            *height = AV_RB16(data + i + 5);
+            *width = AV_RB16(data + i + 7);
+            return *width > 0 && *height > 0 ? 0 : -1;
+        }
+        if (marker == 0xda || length < 2) {
+            return -1;
+        }
+        i += 2 + length;
+    }
+    return -1;
+}
+
+/* The largest idct scaling keeping the short side of the jpeg at or above the target resolution. */
+static int jpeg_lowres(EncoderSession *s, EncodeJob *job) {
+    int width, height, lowres = 0;
+    if (s->options.target_resolution <= 0 || jpeg_dimensions(job->jpeg, job->jpeg_size, &width, &height) < 0) {
+        return 0;
+    }
+    int short_side = FFMIN(width, height);
+    while (lowres < av_codec_get_max_lowres(s->jpg_codec) &&
+           AV_CEIL_RSHIFT(short_side, lowres + 1) >= s->options.target_resolution) {
+        lowres++;
+    }
+    return lowres;
+}
+
+int decode_stage(EncoderSession *s, EncodeJob *job) {
+    AVPacket jpg_pkt;
     int frameFinished = 0;
-    av_read_frame(jpg_fmt_ctx, &jpg_pkt);
-    int ret2 = avcodec_decode_video2(jpg_codec_ctx, yuvframe, &frameFinished, &jpg_pkt);
-    if (ret2 <= 0) {
+    if (job->status < 0) {
+        return job->status;
+    }
+    if (job->frame) {
+        // raw camera frame, converted when it was handed over
+        return 0;
+    }
+    int lowres = jpeg_lowres(s, job);
+    // the decoder only looks at lowres when the picture size changes, a new one is needed
+    if ((!s->jpg_codec_ctx || lowres != av_codec_get_lowres(s->jpg_codec_ctx)) && open_jpeg_decoder(s, lowres) < 0) {
+        return -1;
+    }
+    job->frame = job_frame(job);
+    if (!job->frame) {
+        return AVERROR(ENOMEM);
+    }
+    // the whole jpeg is a single packet, handed to the decoder by reference
+    av_init_packet(&jpg_pkt);
+    jpg_pkt.buf = job->jpeg_buf;
+    jpg_pkt.data = job->jpeg;
+    jpg_pkt.size = job->jpeg_size;
+    jpg_pkt.flags |= AV_PKT_FLAG_KEY;
+    int64_t start = encoder_stats_now();
+    int ret = avcodec_decode_video2(s->jpg_codec_ctx, job->frame, &frameFinished, &jpg_pkt);
+    if (ret <= 0 || !frameFinished) {
         LOGI("error obtaining frame from byte array");
-        ret[1] = -1;
-        return ret;
+        return -1;
     }
-    AVDictionaryEntry *tag = av_dict_get(yuvframe->metadata, "Orientation", NULL, AV_DICT_MATCH_CASE);
+    encoder_stats_record_since(&s->stats, ENCODER_STATS_DECODE, start);
+    AVDictionaryEntry *tag = av_dict_get(job->frame->metadata, "Orientation", NULL, AV_DICT_MATCH_CASE);
     if (tag) {
         LOGI("ORIENTATION IS %s=%s\n", tag->key, tag->value);
-        filter(atoi(tag->value));
+        job->rotation = atoi(tag->value);
     }
-    int retval = 0;
-    if (!h264_codec_ctx || yuvframe->height != h264_codec_ctx->height || yuvframe->width != h264_codec_ctx->width || framecnt >= FRAME_COUNT_LIMIT) {
-        retval = nextFile(yuvframe->width, yuvframe->height);
+    return 0;
+}
+
+/*
+ * Size of a frame whose short side is brought down to short_side, both sides even for the chroma.
+ * Returns 0 when the frame is small enough already.
+ */
+static int scaled_size(int width, int height, int short_side, int *scaled_width, int *scaled_height) {
+    int target = short_side & ~1;
+    int current = FFMIN(width, height);
+    if (target <= 0 || current <= target) {
+        return 0;
     }
-    if (retval < 0) {
-        ret[0] = -1;
-        return ret;
+    int long_side = 2 * (int) lrint((double) FFMAX(width, height) * target / current / 2);
+    *scaled_width = width < height ? target : long_side;
+    *scaled_height = width < height ? long_side : target;
+    return 1;
+}
+
+/* A frame of the job scaled down from src, with planes from the given pool. */
+static AVFrame *scale_frame(EncodeJob *job, const AVFrame *src, AreaScaler **scaler, FramePool **pool, int width, int height) {
+    if (!area_scaler_matches(*scaler, src->width, src->height, width, height)) {
+        area_scaler_free(scaler);
+        *scaler = area_scaler_create(src->width, src->height, width, height);
+    }
+    if (!*scaler || frame_pool_ensure(pool, (enum AVPixelFormat) src->format, width, height) < 0) {
+        LOGE("Could not scale %ix%i to %ix%i", src->width, src->height, width, height);
+        return NULL;
+    }
+    AVFrame *scaled = job_frame(job);
+    if (!scaled || frame_pool_get_buffer(*pool, scaled) < 0) {
+        job_release_frame(job, &scaled);
+        return NULL;
+    }
+    av_frame_copy_props(scaled, src);
+    area_scale_frame(*scaler, src, scaled);
+    return scaled;
+}
+
+/* Brings the short side of the frame down to the target resolution. */
+static int scale(EncoderSession *s, EncodeJob *job) {
+    int width, height;
+    if (!scaled_size(job->frame->width, job->frame->height, s->options.target_resolution, &width, &height)) {
+        return 0;
+    }
+    int64_t start = encoder_stats_now();
+    AVFrame *scaled = scale_frame(job, job->frame, &s->scaler, &s->scale_pool, width, height);
+    if (!scaled) {
+        return -1;
+    }
+    job_release_frame(job, &job->frame);
+    job->frame = scaled;
+    encoder_stats_record_since(&s->stats, ENCODER_STATS_CONVERT, start);
+    return 0;
+}
+
+/* The frame of the proxy rendition, a reference to the frame itself when it is small enough. */
+static int make_proxy(EncoderSession *s, EncodeJob *job) {
+    int width, height;
+    if (!scaled_size(job->frame->width, job->frame->height, s->options.proxy_resolution, &width, &height)) {
+        job->proxy_frame = job_frame(job);
+        return job->proxy_frame ? av_frame_ref(job->proxy_frame, job->frame) : -1;
     }
-    ret[0] = video_index;
+    job->proxy_frame = scale_frame(job, job->frame, &s->proxy_scaler, &s->proxy_pool, width, height);
+    return job->proxy_frame ? 0 : -1;
+}
+
+int filter_stage(EncoderSession *s, EncodeJob *job) {
+    if (job->status < 0) {
+        return job->status;
+    }
+    AVFrame *yuvframe = job->frame;
     LOGI("frame format is %s", av_get_pix_fmt_name((enum AVPixelFormat) yuvframe->format));
     if (yuvframe->format != AV_PIX_FMT_YUVJ420P && yuvframe->format != AV_PIX_FMT_YUV420P) {
         LOGI("converting to proper color format...");
-//        swsscale the shit out of this motherfucker
-        if (!sws_ctx) {
-            sws_ctx = sws_getContext(yuvframe->width, yuvframe->height, (enum AVPixelFormat) yuvframe->format,
-                                     yuvframe->width, yuvframe->height, AV_PIX_FMT_YUVJ420P,
-                                     SWS_BICUBIC, NULL, NULL, NULL);
-        }
-        AVFrame *temp = av_frame_alloc();
-        av_image_fill_arrays(temp->data, temp->linesize, NULL, AV_PIX_FMT_YUVJ420P, yuvframe->width, yuvframe->height, 1);
-        av_image_alloc(temp->data, temp->linesize, yuvframe->width, yuvframe->height, AV_PIX_FMT_YUVJ420P, 1);
-        temp->format = AV_PIX_FMT_YUVJ420P;
-        int ret3 = sws_scale(sws_ctx, (const uint8_t *const *) yuvframe->data, yuvframe->linesize, 0, yuvframe->height, temp->data, temp->linesize);
-        if (ret3 <= 0) {
-            LOGE("Something went wrong while color space conversion returned %i", ret3);
-            av_frame_free(&temp);
-            ret[1] = -1;
-            goto end;
-        }
-        if (temp->width == 0 || temp->height == 0) {
-            temp->width = yuvframe->width;
-            temp->height = yuvframe->height;
-        }
-        if (yuvframe) {
-            LOGI("Freeing initial frame");
-            av_frame_free(&yuvframe);
-            LOGI("Freed initial frame");
-        }
-        yuvframe = temp;
-    }
-    end:
-    if (&jpg_pkt) {
-        av_packet_unref(&jpg_pkt);
-    }
-    LOGI("Decoded jpeg data successfully");
+        int64_t start = encoder_stats_now();
+        AVFrame *temp = job_frame(job);
+        if (!temp || frame_pool_ensure(&s->convert_pool, AV_PIX_FMT_YUVJ420P, yuvframe->width, yuvframe->height) < 0 ||
+            frame_pool_get_buffer(s->convert_pool, temp) < 0) {
+            LOGE("Could not prepare color space conversion");
+            job_release_frame(job, &temp);
+            return -1;
+        }
+        // the chroma subsampling of the jpegs only needs averaging, swscale is kept for the odd formats
+        int ret = yuv_frame_to_420(yuvframe, temp);
+        if (ret == AVERROR(ENOSYS)) {
+            s->sws_ctx = sws_getCachedContext(s->sws_ctx, yuvframe->width, yuvframe->height, (enum AVPixelFormat) yuvframe->format,
+                                              yuvframe->width, yuvframe->height, AV_PIX_FMT_YUVJ420P,
+                                              SWS_BICUBIC, NULL, NULL, NULL);
+            ret = s->sws_ctx ? sws_scale(s->sws_ctx, (const uint8_t *const *) yuvframe->data, yuvframe->linesize, 0, yuvframe->height,
+                                         temp->data, temp->linesize) : -1;
+            ret = ret > 0 ? 0 : -1;
+        }
+        if (ret < 0) {
+            LOGE("Something went wrong while color space conversion returned %i", ret);
+            job_release_frame(job, &temp);
+            return -1;
+        }
+        job_release_frame(job, &job->frame);
+        job->frame = temp;
+        encoder_stats_record_since(&s->stats, ENCODER_STATS_CONVERT, start);
+    }
+    if (scale(s, job) < 0) {
+        LOGE("Could not scale frame");
+        return -1;
+    }
+    if (!s->options.metadata_orientation && rotate(s, job) < 0) {
+        LOGE("Could not rotate frame");
+    }
+    if (s->options.proxy_resolution > 0 && make_proxy(s, job) < 0) {
+        LOGE("Could not make the proxy frame");
+        job_release_frame(job, &job->proxy_frame);
+    }
+    return 0;
+}
+
+/*
+ * Encodes the proxy frame of a job into the proxy of its segment. Runs in frame order, next to the
+ * workers encoding the full frames when there are several. A failure only costs the proxy: the proxy
+ * of the segment is given up, its frames would no longer line up with the segment's.
+ */
+static void encode_proxy(EncoderSession *s, EncodeJob *job) {
+    AVFrame *frame = job->proxy_frame;
+    EncoderSegment *seg = s->proxy_enc_segment;
+    int new_segment = !seg || seg->index != job->video_index;
+    if (s->proxy_failed_index == job->video_index) {
+        goto done;
+    }
+    if (!frame) {
+        goto fail;
+    }
+    if (!s->proxy_codec_ctx || frame->width != s->proxy_codec_ctx->width || frame->height != s->proxy_codec_ctx->height) {
+        // the proxy size follows the frame size, which starts a new segment anyway
+        avcodec_free_context(&s->proxy_codec_ctx);
+        s->proxy_codec_ctx = open_h264(s, frame->width, frame->height, ENCODE_PROXY_CRF);
+        new_segment = 1;
+    }
+    if (!s->proxy_codec_ctx) {
+        goto fail;
+    }
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    if (new_segment) {
+        // the segment still being muxed is finished by the mux stage
+        seg = create_segment(s, s->proxy_codec_ctx, job->video_index, 1);
+        s->proxy_enc_segment = seg;
+        if (!seg) {
+            goto fail;
+        }
+        av_dict_copy(&seg->video_st->metadata, job->segment->video_st->metadata, 0);
+        seg->rotation = job->segment->rotation;
+        frame->pict_type = AV_PICTURE_TYPE_I;
+    }
+    // no delay, a frame without a packet is lost as well
+    if (avcodec_encode_video2(s->proxy_codec_ctx, &job->proxy_pkt, frame, &job->got_proxy_packet) < 0 || !job->got_proxy_packet) {
+        LOGE("Error while encoding proxy frame");
+        job->got_proxy_packet = 0;
+        goto fail;
+    }
+    // the orientation can change within the segment, the rotate tag only gives the first one
+    if (job->got_proxy_packet && s->options.metadata_orientation && add_orientation_sei(&job->proxy_pkt, job->rotation) < 0) {
+        LOGE("Could not add orientation to proxy frame");
+    }
+    job->proxy_segment = seg;
+    seg->total_framecnt++;
+    goto done;
+
+    fail:
+    LOGE("Giving up the proxy of segment %i", job->video_index);
+    s->proxy_failed_index = job->video_index;
+    if (seg && seg->index == job->video_index) {
+        // written by the mux stage up to here, removed once it finishes the file
+        seg->failed = 1;
+    }
+    done:
+    job_release_frame(job, &job->proxy_frame);
+}
+
+int encode_needs_new_encoder(EncoderSession *s, EncodeJob *job) {
+    return job->status >= 0 && (!s->h264_codec_ctx || job->frame->height != s->h264_codec_ctx->height ||
+                                job->frame->width != s->h264_codec_ctx->width);
+}
+
+int encode_prepare(EncoderSession *s, EncodeJob *job) {
+    if (job->status < 0) {
+        return job->status;
+    }
+    AVFrame *yuvframe = job->frame;
+    EncoderSegment *seg = s->enc_segment;
+    int new_encoder = encode_needs_new_encoder(s, job);
+    if (new_encoder) {
+        // only a size change needs a new encoder
+        close_encoder(s);
+        if (initializeEncoder(s, yuvframe->width, yuvframe->height) < 0) {
+            close_encoder(s);
+            return -1;
+        }
+    }
+    yuvframe->pict_type = AV_PICTURE_TYPE_NONE;
+    if (new_encoder || !seg || seg->total_framecnt >= FRAME_COUNT_LIMIT) {
+        int64_t start = encoder_stats_now();
+        seg = nextFile(s);
+        if (!seg) {
+            return -1;
+        }
+        encoder_stats_record_since(&s->stats, ENCODER_STATS_ROLLOVER, start);
+        // every file has to start with an idr frame, the sps/pps are in the stream extradata
+        yuvframe->pict_type = AV_PICTURE_TYPE_I;
+        if (s->options.metadata_orientation) {
+            // read by the mp4 muxer into the tkhd display matrix
+            char degrees[8];
+            snprintf(degrees, sizeof(degrees), "%i", orientation_to_degrees(job->rotation));
+            av_dict_set(&seg->video_st->metadata, "rotate", degrees, 0);
+            seg->rotation = job->rotation;
+        }
+    }
+    job->duration = 1.0 / FPS;
+    if (job->capture_time >= 0) {
+        if (s->last_capture_time >= 0 && job->capture_time > s->last_capture_time) {
+            job->duration = (job->capture_time - s->last_capture_time) / 1000.0;
+        }
+        s->last_capture_time = job->capture_time;
+    }
+    if (s->rate_control.budget_per_km) {
+        int keyframe = yuvframe->pict_type == AV_PICTURE_TYPE_I || s->options.keyframe_interval <= 0;
+        job->complexity = rate_control_complexity(&s->rate_control, yuvframe);
+        job->crf = rate_control_crf(&s->rate_control, job->speed, job->complexity, job->duration, keyframe);
+    }
+    job->segment = seg;
+    job->video_index = seg->index;
+    seg->total_framecnt++;
+    if (s->options.proxy_resolution > 0) {
+        encode_proxy(s, job);
+    }
+    return 0;
+}
+
+int encode_frame(EncoderSession *s, AVCodecContext *ctx, EncodeJob *job) {
+    int enc_got_frame = 0;
+    if (job->status < 0) {
+        return job->status;
+    }
+    if (job->crf > 0) {
+        // x264 is reconfigured when the value changes
+        av_opt_set_double(ctx->priv_data, "crf", job->crf, 0);
+    }
+    int64_t start = encoder_stats_now();
+    if (avcodec_encode_video2(ctx, &job->pkt, job->frame, &enc_got_frame) < 0) {
+        LOGE("Error while encoding frame");
+        return -1;
+    }
+    encoder_stats_record_since(&s->stats, ENCODER_STATS_ENCODE, start);
+    if (enc_got_frame) {
+        encoder_stats_record(&s->stats, ENCODER_STATS_FRAME_SIZE, job->pkt.size);
+    }
+    job->got_packet = enc_got_frame;
+    if (enc_got_frame && s->options.metadata_orientation && add_orientation_sei(&job->pkt, job->rotation) < 0) {
+        LOGE("Could not add orientation to frame");
+    }
+    if (enc_got_frame && job->location.flags && frame_metadata_add_location(&job->pkt, &job->location) < 0) {
+        LOGE("Could not add location to frame");
+    }
+    // the raw frame is not needed anymore, release it before the job waits for the muxer
+    job_release_frame(job, &job->frame);
+    return 0;
+}
+
+int encode_stage(EncoderSession *s, EncodeJob *job) {
+    int ret = encode_prepare(s, job);
+    if (ret < 0) {
+        return ret;
+    }
+    return encode_frame(s, encode_worker_context(s, 0), job);
+}
+
+/*
+ * Writes a packet of a job into seg, pkt being NULL when the encoder gave none. The previous segment,
+ * in *current, is finalized first and the file of a new one opened. Returns the index of the frame in the file.
+ */
+static int write_packet(EncoderSession *s, EncoderSegment **current, EncoderSegment *seg, int status, AVPacket *pkt,
+                        int64_t capture_time) {
+    if (!seg) {
+        return status;
+    }
+    if (seg != *current) {
+        // the encoder moved on, nothing else will be written to the previous file
+        finish_segment(current);
+        *current = seg;
+    }
+    if (status < 0) {
+        return status;
+    }
+    if (!seg->header_written) {
+        seg->start_time = capture_time;
+        if (open_output(s, seg) < 0) {
+            return -1;
+        }
+    }
+    if (!pkt) {
+        LOGI("No frame yet.");
+        return 0;
+    }
+    AVFormatContext *ofmt_ctx = seg->ofmt_ctx;
+    LOGI("Succeed to encode frame: %5d\tsize:%5d\n", seg->framecnt, pkt->size);
+    int frame_index = seg->framecnt;
+    seg->framecnt++;
+    pkt->stream_index = seg->video_st->index;
+
+    AVRational time_base = ofmt_ctx->streams[0]->time_base;
+    AVRational time_base_q = {1, AV_TIME_BASE};
+    AVRational time_base_ms = {1, 1000};
+    int64_t calc_duration = (int64_t) ((double) (AV_TIME_BASE) / (double) FPS);
+    int64_t frame_duration = av_rescale_q(calc_duration, time_base_q, time_base);
+    if (seg->start_time < 0) {
+        pkt->pts = av_rescale_q(seg->framecnt * calc_duration, time_base_q, time_base);
+        pkt->duration = frame_duration;
+    } else {
+        pkt->pts = seg->framecnt == 1 ? 0 : seg->last_pts + frame_duration;
+        if (capture_time >= 0) {
+            pkt->pts = av_rescale_q(capture_time - seg->start_time, time_base_ms, time_base);
+        }
+        if (seg->framecnt > 1) {
+            // the clock may step back, the samples have to stay in order
+            pkt->pts = FFMAX(pkt->pts, seg->last_pts + 1);
+            // the real duration is known with the next frame, the mp4 only uses it for the last one
+            pkt->duration = pkt->pts - seg->last_pts;
+        } else {
+            pkt->duration = frame_duration;
+        }
+    }
+    seg->last_pts = pkt->pts;
+    pkt->dts = pkt->pts;
+    pkt->pos = -1;
+    ofmt_ctx->duration = av_rescale_q(pkt->pts + pkt->duration, time_base, time_base_q);
+
+    // a single stream is not delayed by the interleaving, the sample lands at the current position
+    SegmentIndexRecord record = {
+            .frame_index = frame_index,
+            .offset = avio_tell(ofmt_ctx->pb),
+            .pts = pkt->pts,
+            .keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0,
+    };
+    int ret = av_interleaved_write_frame(ofmt_ctx, pkt);
+    LOGI("Wrote frame, result = %i", ret);
+    av_packet_unref(pkt);
+    if (ret < 0) {
+        LOGE("Error writing frame");
+        return -1;
+    }
+    if (seg->index_file) {
+        record.size = (int) (avio_tell(ofmt_ctx->pb) - record.offset);
+        if (segment_index_append(seg->index_file, &record) < 0) {
+            LOGE("Could not write sample journal, stopped journaling %s", seg->path);
+            close_index(seg, 1);
+        }
+    }
+    if (s->options.fragment_frames > 0 && ++seg->fragment_framecnt >= s->options.fragment_frames) {
+        // close the fragment, everything written so far stays playable if the recording is interrupted
+        ret = av_write_frame(ofmt_ctx, NULL);
+        if (ret < 0) {
+            LOGE("Error writing fragment");
+            return -1;
+        }
+        avio_flush(ofmt_ctx->pb);
+        // down to the io thread, the closed fragment must not wait in memory for the buffer to fill
+        if (async_io_flush(ofmt_ctx->pb) < 0) {
+            LOGE("Error writing fragment");
+            return -1;
+        }
+        seg->fragment_framecnt = 0;
+    }
+    return frame_index;
+}
+
+static int write_job(EncoderSession *s, EncodeJob *job) {
+    if (job->proxy_segment) {
+        AVPacket *proxy_pkt = job->got_proxy_packet ? &job->proxy_pkt : NULL;
+        if (write_packet(s, &s->proxy_mux_segment, job->proxy_segment, job->status, proxy_pkt, job->capture_time) < 0 &&
+            job->status >= 0) {
+            LOGE("Could not write proxy frame");
+            job->proxy_segment->failed = 1;
+        }
+    }
+    int ret = write_packet(s, &s->mux_segment, job->segment, job->status, job->got_packet ? &job->pkt : NULL, job->capture_time);
+    if (ret < 0) {
+        return ret;
+    }
+    if (job->got_packet) {
+        job->frame_index = ret;
+    }
+    return 0;
+}
+
+int mux_stage(EncoderSession *s, EncodeJob *job) {
+    int64_t start = encoder_stats_now();
+    int size = job->got_packet ? job->pkt.size : 0;
+    int keyframe = (job->pkt.flags & AV_PKT_FLAG_KEY) != 0;
+    int ret = write_job(s, job);
+    if (job->got_packet) {
+        encoder_stats_record_since(&s->stats, ENCODER_STATS_MUX, start);
+    }
+    if (job->crf > 0) {
+        // in frame order, the model follows the scene
+        rate_control_update(&s->rate_control, job->speed, job->complexity, job->duration, job->crf, keyframe, size);
+    }
     return ret;
 }
 
+EncoderSession *encoder_session_create(const char *folder, const EncoderOptions *options) {
+    EncoderSession *s = av_mallocz(sizeof(EncoderSession));
+    if (!s) {
+        return NULL;
+    }
+    if (options) {
+        s->options = *options;
+    }
+    rate_control_init(&s->rate_control, (int64_t) FFMAX(s->options.storage_per_km, 0) * 1024);
+    pthread_mutex_init(&s->location_mutex, NULL);
+    pthread_mutex_init(&s->pool_mutex, NULL);
+    s->encode_workers = av_clip(s->options.encode_workers, 1, ENCODE_MAX_WORKERS);
+    if (s->options.keyframe_interval > 0 && s->encode_workers > 1) {
+        // p frames reference the previous frame, a single encoder has to see all of them
+        LOGI("Keyframe interval %i, ignoring %i encode workers", s->options.keyframe_interval, s->encode_workers);
+        s->encode_workers = 1;
+    }
+    s->video_index = -1;
+    s->proxy_failed_index = -1;
+    s->last_capture_time = -1;
+    av_strlcpy(s->folder_path, folder, sizeof(s->folder_path));
+
+    // every jpeg is a complete packet, so the decoder is used without a demuxer
+    s->jpg_codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+    if (!s->jpg_codec) {
+        LOGE("Can not find mjpeg decoder");
+        goto fail;
+    }
+    if (open_jpeg_decoder(s, 0) < 0) {
+        goto fail;
+    }
+    return s;
+
+    fail:
+    encoder_session_free(&s);
+    return NULL;
+}
+
+/*
+ * Finalizes the files still open. The pipeline, if any, has to be stopped before.
+ * Returns 1 if the last segment got no frames.
+ */
+static int encoder_session_finish(EncoderSession *s) {
+    int empty = !s->mux_segment || s->mux_segment->framecnt == 0;
+    if (s->enc_segment == s->mux_segment) {
+        s->enc_segment = NULL;
+    }
+    finish_segment(&s->mux_segment);
+    // a segment which never reached the mux stage
+    finish_segment(&s->enc_segment);
+    if (s->proxy_enc_segment == s->proxy_mux_segment) {
+        s->proxy_enc_segment = NULL;
+    }
+    finish_segment(&s->proxy_mux_segment);
+    finish_segment(&s->proxy_enc_segment);
+    avcodec_free_context(&s->proxy_codec_ctx);
+    close_encoder(s);
+    return empty;
+}
+
+void encoder_session_free(EncoderSession **ps) {
+    EncoderSession *s = *ps;
+    if (!s) {
+        return;
+    }
+    frame_pool_free(&s->rotate_pool);
+    frame_pool_free(&s->convert_pool);
+    frame_pool_free(&s->scale_pool);
+    area_scaler_free(&s->scaler);
+    frame_pool_free(&s->proxy_pool);
+    area_scaler_free(&s->proxy_scaler);
+    if (s->jpg_codec_ctx) {
+        if (!s->jpg_codec_ctx->codec || !s->jpg_codec_ctx->codec->name) {
+            LOGE("'kali crash codec is null while releasing jpeg");
+        }
+        avcodec_free_context(&s->jpg_codec_ctx);
+        LOGI("Closed jpeg decoder");
+    }
+    if (s->sws_ctx) {
+        sws_freeContext(s->sws_ctx);
+        s->sws_ctx = NULL;
+    }
+
+    encoder_session_finish(s);
+    rate_control_uninit(&s->rate_control);
+    pthread_mutex_destroy(&s->location_mutex);
+
+    while (s->free_jobs) {
+        EncodeJob *job = s->free_jobs;
+        s->free_jobs = job->next_free;
+        av_frame_free(&job->spare_frames[0]);
+        av_frame_free(&job->spare_frames[1]);
+        av_free(job);
+    }
+    av_buffer_pool_uninit(&s->jpeg_pool);
+    frame_pool_free(&s->raw_pool);
+    pthread_mutex_destroy(&s->pool_mutex);
+
+    av_freep(ps);
+}
+
 
 JavaVM *jvm;
-jobject *jffmpeg;
+jobject jffmpeg;
 jmethodID method;
+jmethodID frame_encoded_method;
+
+/* guards jffmpeg, which is shared by every open session */
+static pthread_mutex_t jffmpeg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int open_sessions = 0;
+/* JNIEnv of the pipeline threads attached to the vm, detached when the thread exits */
+static pthread_key_t jni_env_key;
 
 void onError(){
     LOGE("FFMPEG caused a crash...");
     JNIEnv *env;
     jint rs = (*jvm)->AttachCurrentThread(jvm, &env, NULL);
     LOGI("JNIEnv attached %d success %s",rs, rs == JNI_OK ? "true" : "false");
-    (*env)->CallVoidMethod(env,jffmpeg,method);
-    LOGI("called method onerror");
+    if (jffmpeg) {
+        (*env)->CallVoidMethod(env, jffmpeg, method);
+        LOGI("called method onerror");
+    }
     (*jvm)->DetachCurrentThread(jvm);
 }
 
+static void detach_thread(void *env) {
+    (*jvm)->DetachCurrentThread(jvm);
+}
 
-JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_initial(JNIEnv *env, jobject obj, jstring folder) {
+/* Process wide setup, done once no matter how many sessions are opened. */
+static void init_once_routine() {
     //FFmpeg av_log() callback
-    int ret = 0;
+    recording_log = native_log_create("/storage/emulated/0/Android/data/com.telenav.streetview/files/av_recording_log.txt",
+                                      NATIVE_LOG_MAX_SIZE);
     av_log_set_callback(custom_log);
 
-    (*env)->GetJavaVM(env, &jvm);
-    jffmpeg = (*env)->NewGlobalRef(env, obj);
-    jclass clazz = (*env)->FindClass(env,"com/telenav/ffmpeg/FFMPEG");
-    method = (*env)->GetMethodID(env, clazz, "onerror", "()V");
-
     initSignalHandler(onError);
 
+    pthread_key_create(&jni_env_key, detach_thread);
+
     /* initialize libavcodec, and register all codecs and formats */
     av_register_all();
-    avfilter_register_all();
+}
 
-    jpg_inf = av_find_input_format("mjpeg");
-    if (jpg_inf == NULL) {
-        LOGI("probe failed\n");
-        ret = -1;
+static JNIEnv *attach_thread() {
+    JNIEnv *env = pthread_getspecific(jni_env_key);
+    if (!env && (*jvm)->GetEnv(jvm, (void **) &env, JNI_VERSION_1_6) == JNI_OK) {
+        // a java thread, or already attached by someone else
+        return env;
     }
-    jpg_avbuff = (unsigned char *) av_malloc(4096);
-
-    AVIOContext *ioctx = avio_alloc_context(jpg_avbuff, 4096, 0, &jpg_buff_pos, &read_packet, NULL, NULL);
+    if (!env) {
+        if ((*jvm)->AttachCurrentThread(jvm, &env, NULL) != JNI_OK) {
+            LOGE("Could not attach encode thread to the vm");
+            return NULL;
+        }
+        pthread_setspecific(jni_env_key, env);
+    }
+    return env;
+}
 
-    jpg_fmt_ctx = avformat_alloc_context();
-    jpg_fmt_ctx->pb = ioctx;
-    if (avformat_open_input(&jpg_fmt_ctx, "memory/jpegdata", jpg_inf, NULL) != 0) {
-        LOGI("error opening AVFormatContext\n");
-        ret = -1;
+/* Called on the mux thread for every submitted frame, in submission order. */
+static void on_frame_encoded(EncoderSession *s, EncodeJob *job) {
+    JNIEnv *env = attach_thread();
+    if (!env || !s->jsession) {
+        return;
     }
+    (*env)->CallVoidMethod(env, s->jsession, frame_encoded_method, job->ticket, job->video_index,
+                           job->status < 0 ? -1 : job->frame_index);
+    if ((*env)->ExceptionCheck(env)) {
+        LOGE("Exception thrown by the frame encoded listener");
+        (*env)->ExceptionClear(env);
+    }
+}
 
-    jpg_codec_ctx = jpg_fmt_ctx->streams[0]->codec;
-    jpg_codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
-    jpg_codec_ctx->color_range = AVCOL_RANGE_JPEG;
-    jpg_codec = avcodec_find_decoder(jpg_codec_ctx->codec_id);
-    if (avcodec_open2(jpg_codec_ctx, jpg_codec, NULL) < 0) {
-        ret = -1;
+
+/* Reads the fields of a java EncoderOptions, null leaves the defaults. */
+static void read_options(JNIEnv *env, jobject joptions, EncoderOptions *options) {
+    memset(options, 0, sizeof(EncoderOptions));
+    if (!joptions) {
+        return;
     }
-    video_index = -1;
+    jclass clazz = (*env)->GetObjectClass(env, joptions);
+    jfieldID metadata_orientation = (*env)->GetFieldID(env, clazz, "mMetadataOrientation", "Z");
+    jfieldID fragment_frames = (*env)->GetFieldID(env, clazz, "mFragmentFrames", "I");
+    jfieldID encode_workers = (*env)->GetFieldID(env, clazz, "mEncodeWorkers", "I");
+    jfieldID keyframe_interval = (*env)->GetFieldID(env, clazz, "mKeyframeInterval", "I");
+    jfieldID storage_per_km = (*env)->GetFieldID(env, clazz, "mStoragePerKm", "I");
+    jfieldID target_resolution = (*env)->GetFieldID(env, clazz, "mTargetResolution", "I");
+    jfieldID proxy_resolution = (*env)->GetFieldID(env, clazz, "mProxyResolution", "I");
+    options->metadata_orientation = (*env)->GetBooleanField(env, joptions, metadata_orientation);
+    options->fragment_frames = (*env)->GetIntField(env, joptions, fragment_frames);
+    options->encode_workers = (*env)->GetIntField(env, joptions, encode_workers);
+    options->keyframe_interval = (*env)->GetIntField(env, joptions, keyframe_interval);
+    options->storage_per_km = (*env)->GetIntField(env, joptions, storage_per_km);
+    options->target_resolution = (*env)->GetIntField(env, joptions, target_resolution);
+    options->proxy_resolution = (*env)->GetIntField(env, joptions, proxy_resolution);
+    (*env)->DeleteLocalRef(env, clazz);
+}
+
+JNIEXPORT jlong JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeInitial(JNIEnv *env, jobject obj, jstring folder, jobject joptions) {
+    (*env)->GetJavaVM(env, &jvm);
+    jclass clazz = (*env)->FindClass(env,"com/telenav/ffmpeg/FFMPEG");
+    method = (*env)->GetMethodID(env, clazz, "onerror", "()V");
+    jclass session_clazz = (*env)->FindClass(env, "com/telenav/ffmpeg/EncoderSession");
+    frame_encoded_method = (*env)->GetMethodID(env, session_clazz, "onFrameEncoded", "(III)V");
+
+    pthread_once(&init_once, init_once_routine);
+
+    EncoderOptions options;
+    read_options(env, joptions, &options);
     const char *temp = (*env)->GetStringUTFChars(env, folder, 0);
-    folder_path = (char *) malloc(1024);
-    size_t length = strlen(temp);
-    strncpy(folder_path, temp, length);
-    folder_path[length] = '\0';
+    EncoderSession *s = encoder_session_create(temp, &options);
     (*env)->ReleaseStringUTFChars(env, folder, temp);
-    return ret;
+    if (!s) {
+        LOGE("Could not create encoder session");
+        return 0;
+    }
+
+    pthread_mutex_lock(&jffmpeg_mutex);
+    if (jffmpeg) {
+        (*env)->DeleteGlobalRef(env, jffmpeg);
+    }
+    jffmpeg = (*env)->NewGlobalRef(env, obj);
+    open_sessions++;
+    pthread_mutex_unlock(&jffmpeg_mutex);
+    return (jlong) (intptr_t) s;
 }
 
 
-JNIEXPORT jintArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_encode(JNIEnv *env, jobject obj, jbyteArray jpeg) {
-    int *ret;
-    int enc_got_frame = 0;
+/* Runs every stage on the calling thread, then frees the job. */
+static void run_job(EncoderSession *s, EncodeJob *job, jlong capture_time, jint *ret) {
+    int i;
+    job->capture_time = capture_time;
+    for (i = 0; i < ENCODE_STAGES; i++) {
+        encode_job_run_stage(s, job, i);
+    }
+    if (job->status < 0) {
+        LOGE("Error while encoding frame");
+    }
+    ret[0] = job->video_index;
+    ret[1] = job->frame_index;
+    encode_job_free(&job);
+}
+
+JNIEXPORT jintArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeEncode(JNIEnv *env, jobject obj, jlong session, jbyteArray jpeg,
+                                                                      jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    jint ret[2] = {-1, -1};
     LOGI("Encoding frame");
     LOGI("----------------------------------------------");
 
-    jbyte *in = (*env)->GetByteArrayElements(env, jpeg, 0);
+    if (s->pipeline) {
+        LOGE("Synchronous encode called while frames are submitted to the pipeline");
+        goto returning;
+    }
+    EncodeJob *job = encode_job_create(s, NULL, 0, (*env)->GetArrayLength(env, jpeg));
+    if (job) {
+        (*env)->GetByteArrayRegion(env, jpeg, 0, job->jpeg_size, (jbyte *) job->jpeg);
+        run_job(s, job, capture_time, ret);
+    }
 
-    ret = decodeJpegData(in, (*env)->GetArrayLength(env, jpeg));
+    returning:;
+    jintArray retArray = (*env)->NewIntArray(env, 2);
+    (*env)->SetIntArrayRegion(env, retArray, 0, 2, ret);
+    return retArray;
+}
 
-    if (ret[0] < 0 || ret[1] < 0) {
-        LOGE("Error while decoding frame");
-        goto returning;
+static void release_direct_buffer(void *opaque, uint8_t *data) {
+    JNIEnv *env = attach_thread();
+    if (env) {
+        (*env)->DeleteGlobalRef(env, (jobject) opaque);
     }
-    pkt.data = NULL;
-    pkt.size = 0;
-    av_init_packet(&pkt);
+}
 
-    if (!&pkt || !yuvframe || !h264_codec_ctx) {
-        LOGE("Error while encoding, not initialized correctly");
-        goto returning;
+/*
+ * Wraps the memory of a direct ByteBuffer without copying it, the buffer object is kept alive until
+ * the last reference is gone. Falls back to a padded copy when the buffer has no room for the padding
+ * the decoder may read past the end of the jpeg.
+ */
+static EncodeJob *create_direct_job(JNIEnv *env, EncoderSession *s, jobject buffer, jint offset, jint length) {
+    uint8_t *data = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, buffer);
+    EncodeJob *job;
+    if (!data || offset < 0 || length <= 0 || capacity < (jlong) offset + length) {
+        LOGE("Invalid direct buffer, capacity %lli offset %i length %i", (long long) capacity, offset, length);
+        return NULL;
     }
-//    LOGI("Encoding frame with w %i h %i, to file with w %i h %i", yuvframe->width, yuvframe->height, h264_codec_ctx->width, h264_codec_ctx->height);
-    if (yuvframe->height != h264_codec_ctx->height || yuvframe->width != h264_codec_ctx->width) {
-        LOGE("Error while encoding frame, incorrect frame orientation");
-        ret[1] = -1;
-        goto skip;
-    }
-
-//    LOGI("encoding video frame with height %i, width %i", yuvframe->height, yuvframe->width);
-    if (avcodec_encode_video2(h264_codec_ctx, &pkt, yuvframe, &enc_got_frame) < 0) {
-        ret[1] = -1;
-    }
-    LOGI("encoded video frame, success = %i", ret[1]);
-    skip:
-    total_framecnt++;
-    if (enc_got_frame == 1) {
-        LOGI("Succeed to encode frame: %5d\tsize:%5d\n", framecnt, pkt.size);
-        ret[1] = framecnt;
-        framecnt++;
-        pkt.stream_index = video_st->index;
-
-        AVRational time_base = ofmt_ctx->streams[0]->time_base;
-        AVRational time_base_q = {1, AV_TIME_BASE};
-        int64_t calc_duration = (int64_t) ((double) (AV_TIME_BASE) / (double) FPS);
-        pkt.pts = av_rescale_q(framecnt * calc_duration, time_base_q, time_base);
-        pkt.dts = pkt.pts;
-        pkt.duration = av_rescale_q(calc_duration, time_base_q, time_base);
-        pkt.pos = -1;
-        ofmt_ctx->duration = pkt.duration * framecnt;
-//        LOGI("pts = %f , dts = %f , dur = %i , totaldur = %f",(double) pkt.pts,(double) pkt.dts,pkt.duration,(double) ofmt_ctx->duration);
-
-        if (ofmt_ctx && ofmt_ctx->streams && ofmt_ctx->streams[0]) {
-            int ret2 = av_interleaved_write_frame(ofmt_ctx, &pkt);
-            LOGI("Wrote frame, result = %i", ret2);
-            av_packet_unref(&pkt);
-            if (ret2 < 0) {
-                LOGE("Error writing frame");
-                ret[1] = -1;
-            }
-            if (!(ofmt_ctx && ofmt_ctx->streams && ofmt_ctx->streams[0])) {
-                LOGI("KALI ofmt_ctx is broken after interleaved write frame");
-            }
-        } else {
-            if (ofmt_ctx)
-                LOGE("File format CTX is NULL");
-            else if (ofmt_ctx->streams)
-                LOGE("File format CTX streams are NULL");
-            else if (ofmt_ctx->streams[0])
-                LOGE("File format CTX stream[0] is NULL");
-            ret[1] = -1;
+    if (capacity >= (jlong) offset + length + AV_INPUT_BUFFER_PADDING_SIZE) {
+        jobject ref = (*env)->NewGlobalRef(env, buffer);
+        AVBufferRef *buf = av_buffer_create(data, (int) capacity, release_direct_buffer, ref, AV_BUFFER_FLAG_READONLY);
+        if (!buf) {
+            (*env)->DeleteGlobalRef(env, ref);
+            return NULL;
         }
+        job = encode_job_create(s, buf, offset, length);
+        av_buffer_unref(&buf);
     } else {
-        LOGI("No frame yet.");
+        job = encode_job_create(s, NULL, 0, length);
+        if (job) {
+            memcpy(job->jpeg, data + offset, (size_t) length);
+        }
+    }
+    return job;
+}
+
+JNIEXPORT jintArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeEncodeDirect(JNIEnv *env, jobject obj, jlong session, jobject buffer,
+                                                                            jint offset, jint length, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    jint ret[2] = {-1, -1};
+    LOGI("Encoding frame from direct buffer");
+    LOGI("----------------------------------------------");
+
+    if (s->pipeline) {
+        LOGE("Synchronous encode called while frames are submitted to the pipeline");
+        goto returning;
     }
-    returning:
-    if (yuvframe) {
-        av_frame_free(&yuvframe);
+    EncodeJob *job = create_direct_job(env, s, buffer, offset, length);
+    if (job) {
+        run_job(s, job, capture_time, ret);
     }
-    (*env)->ReleaseByteArrayElements(env, jpeg, in, JNI_ABORT);
 
+    returning:;
     jintArray retArray = (*env)->NewIntArray(env, 2);
     (*env)->SetIntArrayRegion(env, retArray, 0, 2, ret);
     return retArray;
 }
 
-JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_close(JNIEnv *env, jobject obj) {
-    flush();
-    LOGI("Closing encoder");
-    LOGI("----------------------------------------------");
-    if (filter_graph) {
-        avfilter_graph_free(&filter_graph);
+static int ensure_pipeline(JNIEnv *env, EncoderSession *s, jobject jsession) {
+    if (!s->pipeline) {
+        if (!s->jsession) {
+            s->jsession = (*env)->NewGlobalRef(env, jsession);
+        }
+        s->on_complete = on_frame_encoded;
+        s->pipeline = pipeline_start(s);
+        if (!s->pipeline) {
+            LOGE("Could not start the encode pipeline");
+            return -1;
+        }
     }
-    if (filter_graph_cc) {
-        avfilter_graph_free(&filter_graph_cc);
+    return 0;
+}
+
+/*
+ * Queues a frame on the session's pipeline, started on the first call, and returns its ticket
+ * without waiting for it to be encoded. Returns -1 if the pipeline is still busy with
+ * earlier frames, in which case the frame is dropped.
+ */
+static jint submit_job(EncoderSession *s, EncodeJob *job, jlong capture_time) {
+    if (!job) {
+        return -1;
     }
-    if (filter_graph_flip) {
-        avfilter_graph_free(&filter_graph_flip);
+    job->capture_time = capture_time;
+    int ticket = job->ticket;
+    if (pipeline_submit(s->pipeline, job) < 0) {
+        LOGE("Encode pipeline is full, dropping frame %i", ticket);
+        encode_job_free(&job);
+        return -1;
     }
-    if (jpg_codec_ctx) {
-        if (!jpg_codec_ctx->codec || !jpg_codec_ctx->codec->name) {
-            LOGE("'kali crash codec is null while releasing jpeg");
-        }
-        avcodec_close(jpg_codec_ctx);
-        LOGI("Closed jpeg decoder");
+    return ticket;
+}
+
+JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSubmit(JNIEnv *env, jobject obj, jlong session, jobject jsession, jbyteArray jpeg,
+                                                                jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (ensure_pipeline(env, s, jsession) < 0) {
+        return -1;
     }
-    if (sws_ctx) {
-        sws_freeContext(sws_ctx);
-        sws_ctx = NULL;
+    EncodeJob *job = encode_job_create(s, NULL, 0, (*env)->GetArrayLength(env, jpeg));
+    if (job) {
+        (*env)->GetByteArrayRegion(env, jpeg, 0, job->jpeg_size, (jbyte *) job->jpeg);
     }
+    return submit_job(s, job, capture_time);
+}
 
-    if (h264_codec_ctx) {
-        if (h264_codec_ctx->codec && h264_codec_ctx->codec == pCodec) {
-            if (!h264_codec_ctx->codec || !h264_codec_ctx->codec->name || !pCodec) {
-                LOGE("'kali crash codec is null while releasing");
-            }
-            avcodec_close(h264_codec_ctx);
-            LOGI("Closed h264 encoder");
-        } else {
-            LOGE("Codecs are not the same withing context");
+/* The buffer must not be modified until the frame's completion is delivered. */
+JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSubmitDirect(JNIEnv *env, jobject obj, jlong session, jobject jsession,
+                                                                      jobject buffer, jint offset, jint length, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (ensure_pipeline(env, s, jsession) < 0) {
+        return -1;
+    }
+    return submit_job(s, create_direct_job(env, s, buffer, offset, length), capture_time);
+}
+
+/* Maps the clockwise rotation of a camera frame to the exif orientation handled by the filter stage. */
+static int orientation_from_degrees(int degrees) {
+    switch (((degrees % 360) + 360) % 360) {
+        case 90:
+            return 6;
+        case 180:
+            return 3;
+        case 270:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+static EncodeJob *create_raw_job(EncoderSession *s, int width, int height, int rotation) {
+    EncodeJob *job;
+    if (width <= 0 || height <= 0) {
+        LOGE("Invalid frame size %ix%i", width, height);
+        return NULL;
+    }
+    job = encode_job_create(s, NULL, 0, 0);
+    if (!job) {
+        return NULL;
+    }
+    job->rotation = orientation_from_degrees(rotation);
+    job->frame = job_frame(job);
+    int ret = -1;
+    if (job->frame) {
+        pthread_mutex_lock(&s->pool_mutex);
+        // camera frames use the full range, like the jpegs
+        if (frame_pool_ensure(&s->raw_pool, AV_PIX_FMT_YUVJ420P, width, height) >= 0) {
+            ret = frame_pool_get_buffer(s->raw_pool, job->frame);
         }
+        pthread_mutex_unlock(&s->pool_mutex);
+    }
+    if (ret < 0) {
+        LOGE("Could not allocate raw frame");
+        encode_job_free(&job);
+    }
+    return job;
+}
+
+/* Copies the planes of a YUV_420_888 image into a new job, the buffers are not referenced afterwards. */
+static EncodeJob *create_yuv_job(JNIEnv *env, EncoderSession *s, jobject y, jobject u, jobject v, jint y_row_stride, jint uv_row_stride,
+                                 jint uv_pixel_stride, jint width, jint height, jint rotation) {
+    uint8_t *y_data = (*env)->GetDirectBufferAddress(env, y);
+    uint8_t *u_data = (*env)->GetDirectBufferAddress(env, u);
+    uint8_t *v_data = (*env)->GetDirectBufferAddress(env, v);
+    int chroma_width = (width + 1) >> 1, chroma_height = (height + 1) >> 1;
+    if (!y_data || !u_data || !v_data || width <= 0 || height <= 0 || uv_pixel_stride <= 0 ||
+        y_row_stride < width || uv_row_stride < chroma_width * uv_pixel_stride) {
+        LOGE("Invalid yuv planes for %ix%i, strides %i %i %i", width, height, y_row_stride, uv_row_stride, uv_pixel_stride);
+        return NULL;
+    }
+    // the last row of a plane may end right after its last sample, without the padding of a full stride
+    int64_t y_size = (int64_t) y_row_stride * (height - 1) + width;
+    int64_t uv_size = (int64_t) uv_row_stride * (chroma_height - 1) + (int64_t) (chroma_width - 1) * uv_pixel_stride + 1;
+    if ((*env)->GetDirectBufferCapacity(env, y) < y_size || (*env)->GetDirectBufferCapacity(env, u) < uv_size ||
+        (*env)->GetDirectBufferCapacity(env, v) < uv_size) {
+        LOGE("Yuv planes are too small for %ix%i", width, height);
+        return NULL;
+    }
+    EncodeJob *job = create_raw_job(s, width, height, rotation);
+    if (job && yuv_420_888_to_frame(job->frame, y_data, y_row_stride, u_data, v_data, uv_row_stride, uv_pixel_stride) < 0) {
+        LOGE("Could not convert yuv frame");
+        encode_job_free(&job);
+    }
+    return job;
+}
+
+static EncodeJob *create_nv21_job(JNIEnv *env, EncoderSession *s, jbyteArray data, jint width, jint height, jint rotation) {
+    EncodeJob *job = create_raw_job(s, width, height, rotation);
+    if (!job) {
+        return NULL;
+    }
+    int chroma_stride = ((width + 1) >> 1) << 1;
+    if ((*env)->GetArrayLength(env, data) < width * height + chroma_stride * ((height + 1) >> 1)) {
+        LOGE("NV21 buffer is too small for %ix%i", width, height);
+        encode_job_free(&job);
+        return NULL;
+    }
+    uint8_t *nv21 = (*env)->GetPrimitiveArrayCritical(env, data, NULL);
+    int ret = -1;
+    if (nv21) {
+        ret = yuv_nv21_to_frame(job->frame, nv21, width, nv21 + width * height, chroma_stride);
+        (*env)->ReleasePrimitiveArrayCritical(env, data, nv21, JNI_ABORT);
     }
-    h264_codec_ctx = NULL;
+    if (ret < 0) {
+        encode_job_free(&job);
+    }
+    return job;
+}
 
-    if (ofmt_ctx) {
-//        if (ofmt_ctx->filename && strlen(ofmt_ctx->filename) != 0) {
-//            free(ofmt_ctx->filename);
-//        }
-        if (ofmt_ctx->streams && ofmt_ctx->pb) {
-            avio_close(ofmt_ctx->pb);
+JNIEXPORT jintArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeEncodeYuv(JNIEnv *env, jobject obj, jlong session, jobject y, jobject u,
+                                                                         jobject v, jint y_row_stride, jint uv_row_stride,
+                                                                         jint uv_pixel_stride, jint width, jint height, jint rotation, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    jint ret[2] = {-1, -1};
+    if (s->pipeline) {
+        LOGE("Synchronous encode called while frames are submitted to the pipeline");
+    } else {
+        EncodeJob *job = create_yuv_job(env, s, y, u, v, y_row_stride, uv_row_stride, uv_pixel_stride, width, height, rotation);
+        if (job) {
+            run_job(s, job, capture_time, ret);
         }
-        avformat_free_context(ofmt_ctx);
-        ofmt_ctx = NULL;
-        LOGI("KALI setting null ofmtcontext at close");
     }
+    jintArray retArray = (*env)->NewIntArray(env, 2);
+    (*env)->SetIntArrayRegion(env, retArray, 0, 2, ret);
+    return retArray;
+}
 
-    if (jpg_fmt_ctx) {
-        avformat_close_input(&jpg_fmt_ctx);
+JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSubmitYuv(JNIEnv *env, jobject obj, jlong session, jobject jsession, jobject y,
+                                                                    jobject u, jobject v, jint y_row_stride, jint uv_row_stride,
+                                                                    jint uv_pixel_stride, jint width, jint height, jint rotation, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (ensure_pipeline(env, s, jsession) < 0) {
+        return -1;
     }
+    EncodeJob *job = create_yuv_job(env, s, y, u, v, y_row_stride, uv_row_stride, uv_pixel_stride, width, height, rotation);
+    return submit_job(s, job, capture_time);
+}
 
-    if (jpg_fmt_ctx) {
-        if (jpg_fmt_ctx->pb && jpg_fmt_ctx->pb->buffer){
-            av_freep(jpg_fmt_ctx->pb->buffer);
+JNIEXPORT jintArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeEncodeNv21(JNIEnv *env, jobject obj, jlong session, jbyteArray data,
+                                                                          jint width, jint height, jint rotation, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    jint ret[2] = {-1, -1};
+    if (s->pipeline) {
+        LOGE("Synchronous encode called while frames are submitted to the pipeline");
+    } else {
+        EncodeJob *job = create_nv21_job(env, s, data, width, height, rotation);
+        if (job) {
+            run_job(s, job, capture_time, ret);
         }
-        if (jpg_fmt_ctx->pb)
-            avio_close(jpg_fmt_ctx->pb);
-        avformat_free_context(jpg_fmt_ctx);
-        jpg_fmt_ctx = NULL;
     }
-    if (total_framecnt == 0 && framecnt == 0) {
-        return 1;
+    jintArray retArray = (*env)->NewIntArray(env, 2);
+    (*env)->SetIntArrayRegion(env, retArray, 0, 2, ret);
+    return retArray;
+}
+
+JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSubmitNv21(JNIEnv *env, jobject obj, jlong session, jobject jsession,
+                                                                     jbyteArray data, jint width, jint height, jint rotation, jlong capture_time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (ensure_pipeline(env, s, jsession) < 0) {
+        return -1;
+    }
+    return submit_job(s, create_nv21_job(env, s, data, width, height, rotation), capture_time);
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeGetEncoderStats(JNIEnv *env, jobject obj, jlong session) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    jlong summary[ENCODER_STATS_METRICS * ENCODER_STATS_SUMMARY_SIZE];
+    if (!s) {
+        return NULL;
+    }
+    encoder_stats_summary(&s->stats, (int64_t *) summary);
+    jlongArray result = (*env)->NewLongArray(env, ENCODER_STATS_METRICS * ENCODER_STATS_SUMMARY_SIZE);
+    if (result) {
+        (*env)->SetLongArrayRegion(env, result, 0, ENCODER_STATS_METRICS * ENCODER_STATS_SUMMARY_SIZE, summary);
     }
-    if (folder_path) {
-        free(folder_path);
+    return result;
+}
+
+JNIEXPORT void JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSetSpeed(JNIEnv *env, jobject obj, jlong session, jfloat speed) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (s) {
+        rate_control_set_speed(&s->rate_control, speed);
     }
+}
+
+JNIEXPORT void JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeSetLocation(JNIEnv *env, jobject obj, jlong session, jint flags,
+                                                                       jdouble latitude, jdouble longitude, jfloat bearing,
+                                                                       jfloat speed, jfloat accuracy, jlong time) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (!s) {
+        return;
+    }
+    FrameLocation location = {
+            .flags = flags,
+            .latitude = latitude,
+            .longitude = longitude,
+            .bearing = bearing,
+            .speed = speed,
+            .accuracy = accuracy,
+            .time = time,
+    };
+    pthread_mutex_lock(&s->location_mutex);
+    s->location = location;
+    pthread_mutex_unlock(&s->location_mutex);
+    if (flags & FRAME_METADATA_HAS_SPEED) {
+        rate_control_set_speed(&s->rate_control, speed);
+    }
+}
+
+JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_nativeClose(JNIEnv *env, jobject obj, jlong session) {
+    EncoderSession *s = (EncoderSession *) (intptr_t) session;
+    if (!s) {
+        return -1;
+    }
+    // lets the submitted frames finish, their completions are delivered before this returns
+    pipeline_stop(&s->pipeline);
+    if (s->jsession) {
+        (*env)->DeleteGlobalRef(env, s->jsession);
+        s->jsession = NULL;
+    }
+    LOGI("Closing encoder");
+    LOGI("----------------------------------------------");
+    int ret = encoder_session_finish(s);
+    encoder_session_free(&s);
 
     LOGI("Done");
     LOGI("----------------------------------------------");
-    if (crashlytics_ctx) {
-        crashlytics_free(&crashlytics_ctx);
-    }
-    if (jffmpeg){
-        (*env)->DeleteGlobalRef(env, jffmpeg);
+    pthread_mutex_lock(&jffmpeg_mutex);
+    if (--open_sessions == 0) {
+        if (crashlytics_ctx) {
+            crashlytics_free(&crashlytics_ctx);
+        }
+        if (jffmpeg) {
+            (*env)->DeleteGlobalRef(env, jffmpeg);
+            jffmpeg = NULL;
+        }
     }
-    return 0;
+    pthread_mutex_unlock(&jffmpeg_mutex);
+    return ret;
 }
 
 //void abortHandler( int signum, siginfo_t* si, void* unused )
@@ -833,4 +1747,4 @@ JNIEXPORT jint JNICALL Java_com_telenav_ffmpeg_FFMPEG_close(JNIEnv *env, jobject
 //    sigaction( SIGILL,  &sa, NULL );
 //    sigaction( SIGFPE,  &sa, NULL );
 //    sigaction( SIGPIPE, &sa, NULL );
-//}
\ No newline at end of file
+//}
@@ -0,0 +1,198 @@
+#ifndef ENCODE_H_
+#define ENCODE_H_
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/imgutils.h"
+
+#include <jni.h>
+#include <libswscale/swscale.h>
+#include <libavutil/opt.h>
+
+#include "frame_pool.h"
+#include "encoder_stats.h"
+#include "rate_control.h"
+#include "frame_metadata.h"
+
+#ifdef ANDROID
+#include <android/log.h>
+#define LOGE(format, ...)  __android_log_print(ANDROID_LOG_ERROR, "FFMPEG E ", format, ##__VA_ARGS__)
+#define LOGI(format, ...)  __android_log_print(ANDROID_LOG_INFO,  "FFMPEG I ", format, ##__VA_ARGS__)
+#else
+#define LOGE(format, ...)  printf("FFMPEG E " format "\n", ##__VA_ARGS__)
+#define LOGI(format, ...)  printf("FFMPEG I " format "\n", ##__VA_ARGS__)
+#endif
+
+#define FRAME_COUNT_LIMIT 64
+#define ENCODE_MAX_WORKERS 8
+#define ENCODE_FREE_JOBS 32         // finished jobs kept for reuse, more than the pipeline holds
+
+struct EncodePipeline;
+
+/*
+ * Settings of a session, read from the java EncoderOptions when it is created.
+ */
+typedef struct EncoderOptions {
+    // keep the sensor layout and store the orientation as metadata instead of rotating the pixels
+    int metadata_orientation;
+    // write fragmented mp4, closing a fragment every fragment_frames frames, 0 for a regular mp4
+    int fragment_frames;
+    // h264 encoders working on consecutive frames in parallel, asynchronous api only
+    int encode_workers;
+    // frames between two idr frames, 0 for intra only files
+    int keyframe_interval;
+    // storage budget in kilobytes per kilometre driven, the crf follows the speed hints, 0 for a fixed bitrate
+    int storage_per_km;
+    // short side of the encoded frames in pixels, larger frames are scaled down, 0 to keep the captured size
+    int target_resolution;
+    // short side of a low resolution copy of every segment, written next to it for the local review, 0 for none
+    int proxy_resolution;
+} EncoderOptions;
+
+/*
+ * One output mp4 file, written with the session's encoder.
+ * Created by the encode stage when a rollover is needed, then handed to the mux stage
+ * (through the jobs referencing it) which writes the header, the frames and finally the trailer.
+ */
+typedef struct EncoderSegment {
+    AVFormatContext *ofmt_ctx;
+    AVStream *video_st;
+    char path[1024];
+    int index;
+    int rotation;           // exif orientation written in the track header, metadata orientation only
+    int header_written;
+    int framecnt;           // frames written to the file, mux stage only
+    int fragment_framecnt;  // frames written since the last fragment, fragmented output only
+    FILE *index_file;       // sample journal, regular mp4 output only, see segment_index.h
+    int total_framecnt;     // frames given to the encoder, encode stage only
+    int64_t start_time;     // capture time of the first frame in ms, the pts are relative to it, -1 for a constant frame rate
+    int64_t last_pts;       // mux stage only
+    int proxy;              // the proxy of the segment with the same index, see EncoderOptions.proxy_resolution
+    int failed;             // proxy only, a frame is missing and the file is removed when finished, set before the mux stage finishes it
+} EncoderSegment;
+
+/*
+ * A single frame travelling through the decode -> filter -> encode -> mux stages.
+ */
+typedef struct EncodeJob {
+    int ticket;
+    AVBufferRef *jpeg_buf;  // padded with AV_INPUT_BUFFER_PADDING_SIZE bytes after jpeg_size
+    uint8_t *jpeg;
+    int jpeg_size;
+    AVFrame *frame;
+    AVPacket pkt;
+    int got_packet;
+    int rotation;
+    int64_t capture_time;   // milliseconds, -1 when not given
+    double duration;        // seconds since the previous frame was captured
+    float speed;            // hint at the time the frame was given, meters per second, negative when unknown
+    float complexity;       // see rate_control_complexity
+    float crf;              // 0 when the rate control is off
+    FrameLocation location; // latest location when the frame was given, written into the frame
+    int status;
+    EncoderSegment *segment;
+    // proxy rendition, scaled from frame by the filter stage, a failure there does not fail the job
+    AVFrame *proxy_frame;
+    AVPacket proxy_pkt;
+    int got_proxy_packet;
+    EncoderSegment *proxy_segment;
+    int video_index;
+    int frame_index;
+    // recycling, see encode_job_free
+    struct EncoderSession *session;
+    AVFrame *spare_frames[2];       // unreferenced frames, a job never holds more than two at once
+    struct EncodeJob *next_free;
+} EncodeJob;
+
+/*
+ * All the state needed to record one sequence. A session is created by FFMPEG.initial()
+ * and handed back to encode()/close(), so several sequences can be recorded (or flushed)
+ * at the same time on different threads. The synchronous encode() must not be used from
+ * two threads at once; submit() hands the frame to the session's own pipeline threads.
+ */
+typedef struct EncoderSession {
+    //for jpeg decode, decode stage only
+    AVCodec *jpg_codec;
+    AVCodecContext *jpg_codec_ctx;
+
+    //for filtering (rotate) and color conversion, filter stage only
+    struct SwsContext *sws_ctx;
+    FramePool *rotate_pool;
+    FramePool *convert_pool;
+    struct AreaScaler *scaler;
+    FramePool *scale_pool;
+    struct AreaScaler *proxy_scaler;
+    FramePool *proxy_pool;
+
+    //for encoding, encode stage only
+    AVCodec *pCodec;
+    AVCodecContext *h264_codec_ctx;             // parameters of the segments' streams, the encoder itself without workers
+    AVCodecContext *worker_ctx[ENCODE_MAX_WORKERS];
+    int encode_workers;
+    EncoderSegment *enc_segment;
+    int video_index;
+    int64_t last_capture_time;
+
+    //for the proxy rendition, encoded in frame order by encode_prepare
+    AVCodecContext *proxy_codec_ctx;
+    EncoderSegment *proxy_enc_segment;
+    int proxy_failed_index; // index of the segment whose proxy was given up, -1 if none
+
+    //for muxing, mux stage only
+    EncoderSegment *mux_segment;
+    EncoderSegment *proxy_mux_segment;
+
+    char folder_path[1024];
+    EncoderOptions options;
+    EncoderStats stats;
+    RateControl rate_control;
+    pthread_mutex_t location_mutex;             // the location is set by the app threads
+    FrameLocation location;
+
+    //allocations reused from frame to frame, jobs are created by the app threads and freed by the stages
+    pthread_mutex_t pool_mutex;                 // guards the fields below
+    EncodeJob *free_jobs;
+    int nb_free_jobs;
+    AVBufferPool *jpeg_pool;                    // copies of the jpegs, buffers of jpeg_pool_size bytes
+    int jpeg_pool_size;
+    FramePool *raw_pool;                        // frames handed over by the camera
+
+    //asynchronous api
+    struct EncodePipeline *pipeline;
+    int next_ticket;
+    jobject jsession;
+    void (*on_complete)(struct EncoderSession *s, EncodeJob *job);
+} EncoderSession;
+
+#define ENCODE_STAGES 4
+
+EncoderSession *encoder_session_create(const char *folder, const EncoderOptions *options);
+void encoder_session_free(EncoderSession **ps);
+
+/*
+ * Takes a reference to buf, whose data from offset must be followed by AV_INPUT_BUFFER_PADDING_SIZE readable bytes.
+ * When buf is NULL a zero padded buffer of size bytes is taken from the session, to be filled by the caller through job->jpeg.
+ */
+EncodeJob *encode_job_create(EncoderSession *s, AVBufferRef *buf, int offset, int size);
+
+/* Hands the job back to its session for reuse, every job has to be freed before the session. */
+void encode_job_free(EncodeJob **pjob);
+void encode_job_run_stage(EncoderSession *s, EncodeJob *job, int stage);
+void encode_job_set_result(EncodeJob *job, int ret);
+
+int decode_stage(EncoderSession *s, EncodeJob *job);
+int filter_stage(EncoderSession *s, EncodeJob *job);
+int encode_stage(EncoderSession *s, EncodeJob *job);
+int mux_stage(EncoderSession *s, EncodeJob *job);
+
+/*
+ * The encode stage in two steps, for the parallel pipeline. encode_prepare runs on one thread in
+ * frame order (segment rollover, encoder reopening), encode_frame on the worker owning ctx.
+ * The encoders must be idle when encode_needs_new_encoder returns true for the next job.
+ */
+int encode_needs_new_encoder(EncoderSession *s, EncodeJob *job);
+int encode_prepare(EncoderSession *s, EncodeJob *job);
+int encode_frame(EncoderSession *s, AVCodecContext *ctx, EncodeJob *job);
+AVCodecContext *encode_worker_context(EncoderSession *s, int worker);
+
+#endif /* ENCODE_H_ */
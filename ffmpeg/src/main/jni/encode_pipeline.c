@@ -0,0 +1,253 @@
+#include "encode_pipeline.h"
+
+static void queue_init(JobQueue *q) {
+    memset(q, 0, sizeof(JobQueue));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(JobQueue *q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+/* Returns -1 without blocking if the queue is full and block is 0. */
+static int queue_put(JobQueue *q, EncodeJob *job, int block) {
+    pthread_mutex_lock(&q->mutex);
+    while (q->size >= JOB_QUEUE_SIZE) {
+        if (!block) {
+            pthread_mutex_unlock(&q->mutex);
+            return -1;
+        }
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+    q->jobs[q->windex] = job;
+    if (++q->windex == JOB_QUEUE_SIZE) {
+        q->windex = 0;
+    }
+    q->size++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+/* depth is set to the number of jobs that were waiting, this one included. */
+static EncodeJob *queue_get(JobQueue *q, int *depth) {
+    EncodeJob *job;
+    pthread_mutex_lock(&q->mutex);
+    while (q->size == 0) {
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+    *depth = q->size;
+    job = q->jobs[q->rindex];
+    if (++q->rindex == JOB_QUEUE_SIZE) {
+        q->rindex = 0;
+    }
+    q->size--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+    return job;
+}
+
+/* Waits until the workers are done with every job dealt to them, before their encoders are replaced. */
+static void wait_workers_idle(EncodePipeline *p) {
+    pthread_mutex_lock(&p->idle_mutex);
+    while (p->busy_workers_jobs > 0) {
+        pthread_cond_wait(&p->idle, &p->idle_mutex);
+    }
+    pthread_mutex_unlock(&p->idle_mutex);
+}
+
+static void *worker_thread(void *arg) {
+    EncodeWorker *w = (EncodeWorker *) arg;
+    EncodePipeline *p = w->pipeline;
+    EncoderSession *s = p->session;
+    int depth;
+
+    for (; ;) {
+        EncodeJob *job = queue_get(&w->in, &depth);
+        if (!job) {
+            queue_put(&w->out, NULL, 1);
+            break;
+        }
+        encode_job_set_result(job, encode_frame(s, encode_worker_context(s, w->index), job));
+        queue_put(&w->out, job, 1);
+
+        pthread_mutex_lock(&p->idle_mutex);
+        if (--p->busy_workers_jobs == 0) {
+            pthread_cond_signal(&p->idle);
+        }
+        pthread_mutex_unlock(&p->idle_mutex);
+    }
+    LOGI("Exiting encode worker %d thread", w->index);
+    return NULL;
+}
+
+/*
+ * Prepares a job in frame order and hands it to the next worker. Each worker keeps its own idr_pic_id,
+ * so neighbouring frames from two workers can repeat it, see initializeEncoder.
+ */
+static void deal_job(EncodePipeline *p, StageThread *t, EncodeJob *job) {
+    EncoderSession *s = p->session;
+    if (encode_needs_new_encoder(s, job)) {
+        wait_workers_idle(p);
+    }
+    encode_job_set_result(job, encode_prepare(s, job));
+    pthread_mutex_lock(&p->idle_mutex);
+    p->busy_workers_jobs++;
+    pthread_mutex_unlock(&p->idle_mutex);
+    queue_put(&p->workers[t->jobs++ % p->nb_workers].in, job, 1);
+}
+
+/* The input of a stage, the mux stage of a parallel pipeline reads the workers in the order the jobs were dealt. */
+static EncodeJob *stage_get(EncodePipeline *p, StageThread *t, int *depth) {
+    if (p->nb_workers > 1 && t->stage == ENCODE_STAGE_MUX) {
+        return queue_get(&p->workers[t->jobs++ % p->nb_workers].out, depth);
+    }
+    return queue_get(&p->queues[t->stage], depth);
+}
+
+static void *stage_thread(void *arg) {
+    StageThread *t = (StageThread *) arg;
+    EncodePipeline *p = t->pipeline;
+    EncoderSession *s = p->session;
+    int last = t->stage == ENCODE_STAGES - 1;
+    int i;
+
+    for (; ;) {
+        int depth;
+        EncodeJob *job = stage_get(p, t, &depth);
+        int deal = p->nb_workers > 1 && t->stage == ENCODE_STAGE_ENCODE;
+        if (!job) {
+            // end of stream, pass it on
+            if (deal) {
+                for (i = 0; i < p->nb_workers; i++) {
+                    queue_put(&p->workers[i].in, NULL, 1);
+                }
+            } else if (!last && !(p->nb_workers > 1 && t->stage + 1 == ENCODE_STAGE_MUX)) {
+                queue_put(&p->queues[t->stage + 1], NULL, 1);
+            }
+            break;
+        }
+        encoder_stats_record(&s->stats, ENCODER_STATS_QUEUE_DECODE + t->stage, depth);
+        if (deal) {
+            deal_job(p, t, job);
+            continue;
+        }
+        encode_job_run_stage(s, job, t->stage);
+        if (!last) {
+            queue_put(&p->queues[t->stage + 1], job, 1);
+        } else {
+            if (s->on_complete) {
+                s->on_complete(s, job);
+            }
+            encode_job_free(&job);
+        }
+    }
+    LOGI("Exiting encode stage %d thread", t->stage);
+    return NULL;
+}
+
+/* Joins the first count workers, sending them the end of stream first if end is set. */
+static void join_workers(EncodePipeline *p, int count, int end) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (end) {
+            queue_put(&p->workers[i].in, NULL, 1);
+        }
+        pthread_join(p->workers[i].tid, NULL);
+    }
+}
+
+static void pipeline_free(EncodePipeline **pp) {
+    int i;
+    EncodePipeline *p = *pp;
+    for (i = 0; i < ENCODE_STAGES; i++) {
+        queue_destroy(&p->queues[i]);
+    }
+    for (i = 0; i < ENCODE_MAX_WORKERS; i++) {
+        queue_destroy(&p->workers[i].in);
+        queue_destroy(&p->workers[i].out);
+    }
+    pthread_mutex_destroy(&p->idle_mutex);
+    pthread_cond_destroy(&p->idle);
+    av_freep(pp);
+}
+
+EncodePipeline *pipeline_start(EncoderSession *s) {
+    int i;
+    EncodePipeline *p = av_mallocz(sizeof(EncodePipeline));
+    if (!p) {
+        return NULL;
+    }
+    p->session = s;
+    p->nb_workers = s->encode_workers;
+    pthread_mutex_init(&p->idle_mutex, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    for (i = 0; i < ENCODE_STAGES; i++) {
+        queue_init(&p->queues[i]);
+    }
+    for (i = 0; i < ENCODE_MAX_WORKERS; i++) {
+        queue_init(&p->workers[i].in);
+        queue_init(&p->workers[i].out);
+    }
+    for (i = 0; p->nb_workers > 1 && i < p->nb_workers; i++) {
+        p->workers[i].pipeline = p;
+        p->workers[i].index = i;
+        if (pthread_create(&p->workers[i].tid, NULL, worker_thread, &p->workers[i]) != 0) {
+            LOGE("Could not start encode worker %d", i);
+            join_workers(p, i, 1);
+            pipeline_free(&p);
+            return NULL;
+        }
+    }
+    for (i = 0; i < ENCODE_STAGES; i++) {
+        p->threads[i].pipeline = p;
+        p->threads[i].stage = i;
+        if (pthread_create(&p->threads[i].tid, NULL, stage_thread, &p->threads[i]) != 0) {
+            LOGE("Could not start encode stage %d", i);
+            // stop the stages already running
+            queue_put(&p->queues[0], NULL, 1);
+            int started = i;
+            while (i-- > 0) {
+                pthread_join(p->threads[i].tid, NULL);
+            }
+            if (p->nb_workers > 1) {
+                // the encode stage passed the end of stream to the workers if it was running
+                join_workers(p, p->nb_workers, started <= ENCODE_STAGE_ENCODE);
+            }
+            pipeline_free(&p);
+            return NULL;
+        }
+    }
+    LOGI("Encode pipeline started, %d encode workers", p->nb_workers);
+    return p;
+}
+
+/* Never blocks the caller, returns -1 if the first stage is still busy with a full queue. */
+int pipeline_submit(EncodePipeline *p, EncodeJob *job) {
+    if (!job) {
+        return -1;
+    }
+    return queue_put(&p->queues[0], job, 0);
+}
+
+/* Lets every queued job run to completion, then joins the stage threads. */
+void pipeline_stop(EncodePipeline **pp) {
+    int i;
+    EncodePipeline *p = *pp;
+    if (!p) {
+        return;
+    }
+    queue_put(&p->queues[0], NULL, 1);
+    for (i = 0; i < ENCODE_STAGES; i++) {
+        pthread_join(p->threads[i].tid, NULL);
+    }
+    if (p->nb_workers > 1) {
+        join_workers(p, p->nb_workers, 0);
+    }
+    pipeline_free(pp);
+    LOGI("Encode pipeline stopped");
+}
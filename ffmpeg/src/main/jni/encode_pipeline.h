@@ -0,0 +1,64 @@
+#ifndef ENCODE_PIPELINE_H_
+#define ENCODE_PIPELINE_H_
+
+#include <pthread.h>
+#include "encode.h"
+
+#define JOB_QUEUE_SIZE 4
+
+/*
+ * Bounded blocking queue handing jobs from one stage to the next.
+ * A NULL job marks the end of the stream.
+ */
+typedef struct JobQueue {
+    EncodeJob *jobs[JOB_QUEUE_SIZE];
+    int size, rindex, windex;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} JobQueue;
+
+#define ENCODE_STAGE_ENCODE 2
+#define ENCODE_STAGE_MUX 3
+
+typedef struct StageThread {
+    struct EncodePipeline *pipeline;
+    int stage;
+    int64_t jobs;               // jobs handed to the workers, or collected from them
+    pthread_t tid;
+} StageThread;
+
+/* One h264 encoder of a parallel pipeline, with its own context. */
+typedef struct EncodeWorker {
+    struct EncodePipeline *pipeline;
+    int index;
+    JobQueue in;
+    JobQueue out;
+    pthread_t tid;
+} EncodeWorker;
+
+/*
+ * Runs every stage of a session on its own thread, so the throughput is bound by the
+ * slowest stage instead of the sum of all of them. Jobs leave the last stage in
+ * submission order and are reported through EncoderSession.on_complete.
+ *
+ * With several encode workers the encode stage thread only prepares the jobs, in order,
+ * and deals them round robin to the workers; the mux stage collects them in the same
+ * order, which puts the frames back in sequence whichever worker finishes first.
+ */
+typedef struct EncodePipeline {
+    EncoderSession *session;
+    JobQueue queues[ENCODE_STAGES];
+    StageThread threads[ENCODE_STAGES];
+    EncodeWorker workers[ENCODE_MAX_WORKERS];
+    int nb_workers;
+    int busy_workers_jobs;      // jobs dealt and not encoded yet
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle;
+} EncodePipeline;
+
+EncodePipeline *pipeline_start(EncoderSession *s);
+int pipeline_submit(EncodePipeline *p, EncodeJob *job);
+void pipeline_stop(EncodePipeline **pp);
+
+#endif /* ENCODE_PIPELINE_H_ */
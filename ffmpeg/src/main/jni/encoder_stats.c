@@ -0,0 +1,63 @@
+#include "encoder_stats.h"
+
+#include "libavutil/common.h"
+
+static int bucket_index(int64_t value) {
+    if (value < 16) {
+        return value < 0 ? 0 : (int) value;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long) value);
+    int index = 16 + (msb - 4) * 4 + (int) ((value >> (msb - 2)) & 3);
+    return FFMIN(index, ENCODER_STATS_BUCKETS - 1);
+}
+
+/* The largest value falling into a bucket. */
+static int64_t bucket_upper_bound(int index) {
+    if (index < 16) {
+        return index;
+    }
+    int msb = (index - 16) / 4 + 4;
+    int64_t step = (int64_t) 1 << (msb - 2);
+    return (4 + (index - 16) % 4) * step + step - 1;
+}
+
+void encoder_stats_record(EncoderStats *stats, enum EncoderStatsMetric metric, int64_t value) {
+    StatsHistogram *h = &stats->metrics[metric];
+    uint32_t clipped = (uint32_t) av_clip64(value, 0, UINT32_MAX);
+    __atomic_add_fetch(&h->buckets[bucket_index(value)], 1, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (clipped > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, clipped, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Reads the buckets once, the recording threads may go on meanwhile. */
+static void histogram_summary(StatsHistogram *h, int64_t *out) {
+    static const int permille[] = {500, 950, 990};
+    uint32_t buckets[ENCODER_STATS_BUCKETS];
+    uint64_t count = 0;
+    int i, p = 0;
+    for (i = 0; i < ENCODER_STATS_BUCKETS; i++) {
+        buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        count += buckets[i];
+    }
+    int64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    out[0] = (int64_t) count;
+    out[1] = out[2] = out[3] = 0;
+    out[4] = max;
+    uint64_t seen = 0;
+    for (i = 0; i < ENCODER_STATS_BUCKETS && p < 3 && count; i++) {
+        seen += buckets[i];
+        while (p < 3 && seen * 1000 >= count * permille[p]) {
+            out[1 + p] = FFMIN(bucket_upper_bound(i), max);
+            p++;
+        }
+    }
+}
+
+void encoder_stats_summary(EncoderStats *stats, int64_t *out) {
+    int i;
+    for (i = 0; i < ENCODER_STATS_METRICS; i++) {
+        histogram_summary(&stats->metrics[i], out + i * ENCODER_STATS_SUMMARY_SIZE);
+    }
+}
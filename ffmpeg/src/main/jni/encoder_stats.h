@@ -0,0 +1,60 @@
+#ifndef ENCODER_STATS_H_
+#define ENCODER_STATS_H_
+
+#include <stdint.h>
+
+#include "libavutil/time.h"
+
+/* The order is the layout of the array returned to java, see EncoderStats.java. */
+enum EncoderStatsMetric {
+    ENCODER_STATS_DECODE,           // jpeg decode, microseconds
+    ENCODER_STATS_ROTATE,           // orientation filter, microseconds
+    ENCODER_STATS_CONVERT,          // color conversion and scaling, microseconds
+    ENCODER_STATS_ENCODE,           // x264, microseconds
+    ENCODER_STATS_MUX,              // mux stage including the file writes, microseconds
+    ENCODER_STATS_ROLLOVER,         // creation of the next segment, microseconds
+    ENCODER_STATS_FRAME_SIZE,       // encoded frame, bytes
+    ENCODER_STATS_QUEUE_DECODE,     // jobs waiting in front of a pipeline stage when it takes one
+    ENCODER_STATS_QUEUE_FILTER,
+    ENCODER_STATS_QUEUE_ENCODE,
+    ENCODER_STATS_QUEUE_MUX,
+    ENCODER_STATS_METRICS
+};
+
+/* Values per metric in encoder_stats_summary: count, p50, p95, p99, max. */
+#define ENCODER_STATS_SUMMARY_SIZE 5
+
+/*
+ * Values below 16 have their own bucket, above that every power of two is split in 4,
+ * so a percentile is off by less than 25%.
+ */
+#define ENCODER_STATS_BUCKETS 160
+
+typedef struct StatsHistogram {
+    uint32_t buckets[ENCODER_STATS_BUCKETS];
+    uint32_t max;           // 32 bits, armv5 has no 64 bit atomics
+} StatsHistogram;
+
+/*
+ * Histograms of the per frame costs of a session. Recording is a relaxed atomic increment,
+ * so the stage threads never wait for each other or for a reader.
+ */
+typedef struct EncoderStats {
+    StatsHistogram metrics[ENCODER_STATS_METRICS];
+} EncoderStats;
+
+static inline int64_t encoder_stats_now(void) {
+    return av_gettime_relative();
+}
+
+void encoder_stats_record(EncoderStats *stats, enum EncoderStatsMetric metric, int64_t value);
+
+/* Records the time elapsed since start, as returned by encoder_stats_now. */
+static inline void encoder_stats_record_since(EncoderStats *stats, enum EncoderStatsMetric metric, int64_t start) {
+    encoder_stats_record(stats, metric, encoder_stats_now() - start);
+}
+
+/* Fills ENCODER_STATS_METRICS * ENCODER_STATS_SUMMARY_SIZE values. */
+void encoder_stats_summary(EncoderStats *stats, int64_t *out);
+
+#endif /* ENCODER_STATS_H_ */
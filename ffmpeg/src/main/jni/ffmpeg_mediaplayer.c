@@ -7,74 +7,129 @@ void packet_queue_init(PacketQueue *q) {
     q->cond = SDL_CreateCond();
 }
 
+static int packet_queue_count(PacketQueue *q) {
+    return (int) (__atomic_load_n(&q->write_pos, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->read_pos, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Takes the mutex to sleep on the ring. The sleeper is counted before the caller looks at the ring,
+ * the fence pairs with the one of packet_queue_wake so either the sleeper sees the new position or
+ * the other side sees the sleeper.
+ */
+static void packet_queue_wait_begin(PacketQueue *q) {
+    SDL_LockMutex(q->mutex);
+    __atomic_add_fetch(&q->sleepers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void packet_queue_wait_end(PacketQueue *q) {
+    __atomic_sub_fetch(&q->sleepers, 1, __ATOMIC_RELAXED);
+    SDL_UnlockMutex(q->mutex);
+}
+
+/* Called after a position moved, takes the mutex only when the other thread sleeps on the ring. */
+static void packet_queue_wake(PacketQueue *q) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->sleepers, __ATOMIC_RELAXED)) {
+        SDL_LockMutex(q->mutex);
+        SDL_CondBroadcast(q->cond);
+        SDL_UnlockMutex(q->mutex);
+    }
+}
+
+/*
+ * Read thread only. Takes the packet over, waits while the ring is full. The packet is dropped if
+ * the player quits before there is room.
+ */
 int packet_queue_put(VideoState *is, PacketQueue *q, AVPacket *pkt, int index) {
 //    LOGI("Packet queue put");
-    AVPacketList *pkt1;
-//    if (pkt != &is->flush_pkt && av_dup_packet(pkt) < 0) {
-//        return -1;
-//    }
-    pkt1 = av_malloc(sizeof(AVPacketList));
-//    if (!pkt1)
-//        return -1;
-    pkt1->pkt = *pkt;
-    pkt1->index = index;
-    pkt1->next = NULL;
-
-    if (!q->last_pkt)
-        q->first_pkt = pkt1;
-    else
-        q->last_pkt->next = pkt1;
-    q->last_pkt = pkt1;
-    q->nb_packets++;
-    q->size += pkt1->pkt.size;
-//    SDL_CondSignal(q->cond);
-//    LOGI("PUT Packet queue condition signaled");
+    uint32_t write_pos = q->write_pos;
+    if (write_pos - __atomic_load_n(&q->read_pos, __ATOMIC_ACQUIRE) >= PACKET_QUEUE_SLOTS) {
+        int full = 1;
+        packet_queue_wait_begin(q);
+        while ((full = write_pos - __atomic_load_n(&q->read_pos, __ATOMIC_ACQUIRE) >= PACKET_QUEUE_SLOTS) && !is->quit) {
+            SDL_CondWait(q->cond, q->mutex);
+        }
+        packet_queue_wait_end(q);
+        if (full) {
+            if (pkt->data != is->flush_pkt.data) {
+                av_packet_unref(pkt);
+            }
+            return -1;
+        }
+    }
+    PacketSlot *slot = &q->slots[write_pos & (PACKET_QUEUE_SLOTS - 1)];
+    slot->pkt = *pkt;
+    slot->index = index;
+    __atomic_store_n(&q->write_pos, write_pos + 1, __ATOMIC_RELEASE);
+    packet_queue_wake(q);
     return 0;
 }
 
+/*
+ * Decode thread only. Blocks until there is a packet, returns its index. Returns -1 without a packet
+ * once the player quits, the same as the exit packet.
+ */
 static int packet_queue_get(VideoState *is, PacketQueue *q, AVPacket *pkt) {
 //    LOGI("Packet queue get");
-    AVPacketList *pkt1;
+    uint32_t read_pos = q->read_pos;
     int ret;
 
-    for (; ;) {
-        pkt1 = q->first_pkt;
-        if (pkt1) {
-            q->first_pkt = pkt1->next;
-            if (!q->first_pkt)
-                q->last_pkt = NULL;
-            q->nb_packets--;
-            q->size -= pkt1->pkt.size;
-            *pkt = pkt1->pkt;
-            av_free(pkt1);
-            ret = pkt1->index;
-            if (ret == -1){
-                LOGI("Packet queue returning exit packet");
-            }
-//            LOGI("Packet queue returning %d", ret);
-            break;
-        } else {
-            SDL_Delay(10);
-            continue;
+    if (__atomic_load_n(&q->write_pos, __ATOMIC_ACQUIRE) == read_pos) {
+        packet_queue_wait_begin(q);
+        while (__atomic_load_n(&q->write_pos, __ATOMIC_ACQUIRE) == read_pos && !is->quit) {
+            SDL_CondWait(q->cond, q->mutex);
         }
+        packet_queue_wait_end(q);
+    }
+    if (__atomic_load_n(&q->write_pos, __ATOMIC_ACQUIRE) != read_pos) {
+        PacketSlot *slot = &q->slots[read_pos & (PACKET_QUEUE_SLOTS - 1)];
+        *pkt = slot->pkt;
+        ret = slot->index;
+        // the slot is free for the read thread again
+        __atomic_store_n(&q->read_pos, read_pos + 1, __ATOMIC_RELEASE);
+        packet_queue_wake(q);
+    } else {
+        av_init_packet(pkt);
+        pkt->data = NULL;
+        pkt->size = 0;
+        ret = -1;
+    }
+    if (ret == -1){
+        LOGI("Packet queue returning exit packet");
     }
     return ret;
 }
 
-static void packet_queue_flush(PacketQueue *q) {
-    AVPacketList *pkt, *pkt1;
+/* Drops the packets left, from the decode thread or once the player threads are joined. */
+static void packet_queue_flush(VideoState *is, PacketQueue *q) {
+    uint32_t read_pos = q->read_pos;
+    while (__atomic_load_n(&q->write_pos, __ATOMIC_ACQUIRE) != read_pos) {
+        AVPacket *pkt = &q->slots[read_pos & (PACKET_QUEUE_SLOTS - 1)].pkt;
+        if (pkt->data != is->flush_pkt.data) {
+            av_packet_unref(pkt);
+        }
+        read_pos++;
+    }
+    __atomic_store_n(&q->read_pos, read_pos, __ATOMIC_RELEASE);
+    packet_queue_wake(q);
+}
 
-    SDL_LockMutex(q->mutex);
-    for (pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
-        pkt1 = pkt->next;
-        av_packet_unref(&pkt->pkt);
-        av_freep(&pkt);
+/*
+ * Wakes the threads waiting on the packet or the picture queue, after quit, paused or a step or seek
+ * request changed. The flags are set before, the waiters check them holding the queue mutex.
+ */
+static void wake_threads(VideoState *is) {
+    if (is->videoq.initialized == 1) {
+        SDL_LockMutex(is->videoq.mutex);
+        SDL_CondBroadcast(is->videoq.cond);
+        SDL_UnlockMutex(is->videoq.mutex);
+    }
+    if (is->pictq_mutex) {
+        SDL_LockMutex(is->pictq_mutex);
+        SDL_CondBroadcast(is->pictq_cond);
+        SDL_UnlockMutex(is->pictq_mutex);
     }
-    q->last_pkt = NULL;
-    q->first_pkt = NULL;
-    q->nb_packets = 0;
-    q->size = 0;
-    SDL_UnlockMutex(q->mutex);
 }
 
 void alloc_picture(VideoState **ps) {
@@ -100,6 +155,21 @@ void alloc_picture(VideoState **ps) {
 
 }
 
+/*
+ * Clockwise rotation, in degrees, to display a frame. The display orientation SEI carried by
+ * the frame wins over the track header, as the orientation can change within one file.
+ */
+static int get_frame_rotation(VideoState *is, AVFrame *pFrame) {
+    AVFrameSideData *sd = av_frame_get_side_data(pFrame, AV_FRAME_DATA_DISPLAYMATRIX);
+    int degrees;
+    if (!sd) {
+        return is->rotation;
+    }
+    degrees = (int) lrint(-av_display_rotation_get((int32_t *) sd->data));
+    degrees = ((degrees % 360) + 360) % 360;
+    return (degrees + 45) / 90 * 90 % 360;
+}
+
 int queue_picture(VideoState *is, AVFrame *pFrame, int index) {
 
     VideoPicture *vp;
@@ -134,6 +204,7 @@ int queue_picture(VideoState *is, AVFrame *pFrame, int index) {
     if (vp->bmp) {
         SDL_LockMutex(is->display_mutex);
         updateBmp(&is->video_player, is->sws_ctx, is->video_st->codec, vp->bmp, pFrame, is->video_st->codec->width, is->video_st->codec->height);
+        vp->bmp->rotation = get_frame_rotation(is, pFrame);
         SDL_UnlockMutex(is->display_mutex);
     }
     vp->index = index;
@@ -144,6 +215,7 @@ int queue_picture(VideoState *is, AVFrame *pFrame, int index) {
     SDL_LockMutex(is->pictq_mutex);
     is->pictq_size++;
 //     LOGI("--------------------------------Queue Picture %i for %i.mp4", index, is->file_index);
+    SDL_CondBroadcast(is->pictq_cond);
     SDL_UnlockMutex(is->pictq_mutex);
     return index;
 }
@@ -155,12 +227,8 @@ void video_display(VideoState *is) {
 
     vp = &is->pictq[is->pictq_rindex];
     if (vp && vp->bmp && vp->index > 0) {
+        // the buffer stays with the picture, the next frame queued in this slot is scaled into it
         displayBmp(&is->video_player, vp->bmp, is->video_st->codec, is->video_st->codec->width, is->video_st->codec->height);
-        if (vp->bmp && vp->bmp->buffer) {
-//            LOGI("Releasing frame buffer %p for file %i", vp->bmp->buffer,is->file_index);
-            av_free(vp->bmp->buffer);
-            vp->bmp->buffer = NULL;
-        }
     }
 
     SDL_UnlockMutex(is->display_mutex);
@@ -173,20 +241,17 @@ void display_thread(void *opaque) {
     VideoPicture *vp;
 
     for (; ;) {
-        if (is->paused) {
+        // woken by a new picture, a step or a resume. On quit the pause is ignored, the decode thread
+        // still queues its exit picture
+        SDL_LockMutex(is->pictq_mutex);
+        while (is->pictq_size == 0 || (is->paused && !is->step_req_display && !is->quit)) {
 //            LOGI("Playback Paused");
-            if (is->step_req_display){
-                is->step_req_display = 0;
-            } else {
-                SDL_Delay(10);
-                continue;
-            }
+            SDL_CondWait(is->pictq_cond, is->pictq_mutex);
         }
-        if (is->pictq_size == 0) {
-//            LOGI("Playback Paused");
-            SDL_Delay(10);
-            continue;
+        if (is->paused) {
+            is->step_req_display = 0;
         }
+        SDL_UnlockMutex(is->pictq_mutex);
 
         if (is->video_st) {
             vp = &is->pictq[is->pictq_rindex];
@@ -225,16 +290,14 @@ void display_thread(void *opaque) {
             continue;
         }
     }
+    // every file of the track keeps its state, the buffers are only held while it plays
     SDL_LockMutex(is->display_mutex);
     int i;
     for (i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++){
-        VideoPicture pict = is->pictq[i];
-        if (pict.allocated && pict.bmp && pict.bmp->buffer){
-            if (pict.bmp->buffer) {
-                LOGI("Releasing frame buffer %p for file %i", pict.bmp->buffer,is->file_index);
-                av_free(pict.bmp->buffer);
-                pict.bmp->buffer = NULL;
-            }
+        VideoPicture *pict = &is->pictq[i];
+        if (pict->allocated && pict->bmp && pict->bmp->buffer){
+            LOGI("Releasing frame buffer %p for file %i", pict->bmp->buffer,is->file_index);
+            releaseBmpBuffer(pict->bmp);
         }
     }
     SDL_UnlockMutex(is->display_mutex);
@@ -264,6 +327,7 @@ int frame_decode_thread(void *arg) {
 //    LOGI("Starting frame decode thread for %d", is->file_index);
     AVPacket pkt1, *packet = &pkt1;
     int frameFinished;
+    int skip_until_index = 0;
     AVFrame *pFrame;
 
     pFrame = av_frame_alloc();
@@ -282,6 +346,8 @@ int frame_decode_thread(void *arg) {
         if (packet->data == is->flush_pkt.data) {
             LOGI("Flushing on video thread");
             avcodec_flush_buffers(is->video_st->codec);
+            // the flush packet carries the frame the seek asked for
+            skip_until_index = pkt_index;
             continue;
         }
         // Decode video frame
@@ -291,6 +357,11 @@ int frame_decode_thread(void *arg) {
         }
 
         // Did we get a video frame?
+        if (frameFinished && pkt_index < skip_until_index) {
+            // decoded only as a reference of the frames up to the seek target
+            av_packet_unref(packet);
+            continue;
+        }
         if (frameFinished) {
 //            LOGI("-----------------Video Thread Frame finished decoding %i for %i.mp4", pkt_index, is->file_index);
             if (queue_picture(is, pFrame, pkt_index) < 0) {
@@ -315,6 +386,32 @@ int frame_decode_thread(void *arg) {
     return 0;
 }
 
+/*
+ * Sets the frame count and the frame duration used for seeking. Fragmented files have no
+ * sample count in their moov, the index built from the fragments is used then.
+ */
+static void set_frame_count(VideoState *is) {
+    AVStream *st = is->video_st;
+    int64_t dur = 0;
+    is->frame_count = st->nb_frames;
+    if (is->frame_count <= 0) {
+        is->frame_count = st->nb_index_entries;
+    }
+    if (st->nb_frames > 0 && st->duration > 0) {
+        dur = st->duration / st->nb_frames;
+    } else if (st->nb_index_entries > 1) {
+        dur = (st->index_entries[st->nb_index_entries - 1].timestamp - st->index_entries[0].timestamp)
+              / (st->nb_index_entries - 1);
+    }
+    if (dur > 0) {
+        is->frame_dur = av_rescale_q(dur, st->time_base, AV_TIME_BASE_Q);
+    } else if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0) {
+        is->frame_dur = av_rescale_q(1, av_inv_q(st->avg_frame_rate), AV_TIME_BASE_Q);
+    } else {
+        is->frame_dur = av_rescale_q(1, st->time_base, AV_TIME_BASE_Q);
+    }
+}
+
 int stream_component_open(VideoState *is, int stream_index) { // Todo 1.59 mb memory leak per file
 
     AVFormatContext *pFormatCtx = is->pFormatCtx;
@@ -346,8 +443,7 @@ int stream_component_open(VideoState *is, int stream_index) { // Todo 1.59 mb me
         }
         is->videoStream = stream_index;
         is->video_st = pFormatCtx->streams[stream_index];
-        is->frame_count = is->video_st->nb_frames;
-        is->frame_dur = av_rescale_q(is->video_st->duration / is->video_st->nb_frames, is->video_st->time_base, AV_TIME_BASE_Q);;
+        set_frame_count(is);
 
         packet_queue_init(&is->videoq);
 
@@ -403,7 +499,12 @@ int packet_read_thread(void *arg) {
 //                    seekTo_l(&is,is->pkt_index-2);
 //                }
             } else {
-                SDL_Delay(10);
+                // until resumed, stepped or stopped, the loop then starts over
+                SDL_LockMutex(is->videoq.mutex);
+                while (is->paused && !is->step_req_read && !is->quit) {
+                    SDL_CondWait(is->videoq.cond, is->videoq.mutex);
+                }
+                SDL_UnlockMutex(is->videoq.mutex);
                 continue;
             }
         }
@@ -416,25 +517,39 @@ int packet_read_thread(void *arg) {
             int64_t seek_min = is->seek_rel > 0 ? seek_target - is->seek_rel + 2 : INT64_MIN;
             int64_t seek_max = is->seek_rel < 0 ? seek_target - is->seek_rel - 2 : INT64_MAX;
 
-            int retseek = avformat_seek_file(is->pFormatCtx, -1, seek_target, seek_target, seek_target, is->seek_flags);
+            AVStream *st = is->video_st;
+            int retseek;
+            // with p frames the target can only be decoded starting from the keyframe at or before it
+            if (is->seek_frame >= 0 && st->nb_index_entries > 0) {
+                // looked up in the sample index, the frames may be spaced irregularly. Frame n keeps meaning
+                // the sample at n frame durations of a constant rate file, which is sample n - 1
+                is->seek_target_index = av_clip(is->seek_frame - 1, 0, st->nb_index_entries - 1);
+                int64_t ts = st->index_entries[is->seek_target_index].timestamp;
+                retseek = avformat_seek_file(is->pFormatCtx, is->videoStream, INT64_MIN, ts, ts, is->seek_flags);
+            } else {
+                // same numbering as pkt_index, the frame at seek_target has pts (index + 1) * duration
+                is->seek_target_index = is->frame_dur > 0 ?
+                        FFMAX((int) ((seek_target + is->frame_dur / 2) / is->frame_dur) - 1, 0) : 0;
+                retseek = avformat_seek_file(is->pFormatCtx, -1, INT64_MIN, seek_target, seek_target, is->seek_flags);
+            }
             if (retseek < 0) {
                 LOGE("%s: error while seeking\n", is->pFormatCtx->filename);
                 notify_from_thread(is, MEDIA_SEEK_COMPLETE, retseek, 0);
             } else {
                 if (is->videoStream >= 0) {
-//                    packet_queue_flush(&is->videoq);
-                    packet_queue_put(is, &is->videoq, &is->flush_pkt, 0);
+//                    packet_queue_flush(is, &is->videoq);
+                    packet_queue_put(is, &is->videoq, &is->flush_pkt, is->seek_target_index);
                 }
                 LOGI("Completed seek request");
                 notify_from_thread(is, MEDIA_SEEK_COMPLETE, 0, 0);
             }
             is->seek_req = 0;
-            if (!(*is->backwards && is->pkt_index == 0)){
+            if (!(*is->backwards && is->pkt_index == 0 && is->seek_target_index == 0)){
                 is->eof = 0;
             }
         }
 
-//        if (is->videoq.nb_packets >= MAX_VIDEOQ_NR && !is->started) {
+//        if (packet_queue_count(&is->videoq) >= DEFAULT_READ_AHEAD && !is->started) {
 //            is->started = 1;
 //            notify_from_thread(is, MEDIA_PLAYBACK_PLAYING, 0, 0);
 //            VideoState *prev = getPreviousMediaPlayer(&is);
@@ -454,13 +569,23 @@ int packet_read_thread(void *arg) {
 //
 //        }
 
-        if (is->videoq.nb_packets >= MAX_VIDEOQ_NR) {
-//            LOGI("Loaded max frames, sleeping...");
-            if (is->paused){
-                is->step_req_read = 1;
-                is->step_req_decode = 1;
+        // wait for the decode thread to take a packet, a quit, seek or pause change is handled first
+        int read_ahead = is->read_ahead ? av_clip(*is->read_ahead, 1, MAX_READ_AHEAD) : DEFAULT_READ_AHEAD;
+        int full = packet_queue_count(&is->videoq) >= read_ahead;
+        if (full) {
+            packet_queue_wait_begin(&is->videoq);
+            while ((full = packet_queue_count(&is->videoq) >= read_ahead) &&
+                   !is->quit && !is->seek_req && is->paused == is->last_paused) {
+//                LOGI("Loaded max frames, sleeping...");
+                if (is->paused){
+                    is->step_req_read = 1;
+                    is->step_req_decode = 1;
+                }
+                SDL_CondWait(is->videoq.cond, is->videoq.mutex);
             }
-            SDL_Delay(10);
+            packet_queue_wait_end(&is->videoq);
+        }
+        if (full) {
             continue;
         }
         if ((ret = av_read_frame(is->pFormatCtx, packet)) < 0) {
@@ -475,10 +600,17 @@ int packet_read_thread(void *arg) {
                 continue;
             }
         } else {
-            if (packet->duration > 0) {
-                is->pkt_index = (int) (packet->pts / packet->duration) - 1;
+            if (packet->stream_index == is->videoStream) {
+                // the position in the sample index, the frame times are the capture times
+                int index = av_index_search_timestamp(is->video_st, packet->dts, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD);
+                if (index >= 0) {
+                    is->pkt_index = index;
+                } else if (packet->duration > 0) {
+                    is->pkt_index = (int) (packet->pts / packet->duration) - 1;
+                }
             }
-            if (*is->backwards && is->pkt_index == 0 && !is->eof){
+            // the start of the file only when sample 0 is the target, otherwise it is a reference of a later one
+            if (*is->backwards && is->pkt_index == 0 && is->seek_target_index == 0 && !is->eof){
                 packet_queue_put(is, &is->videoq, packet, is->pkt_index);
                 is->eof = 1;
                 continue;
@@ -505,7 +637,8 @@ int packet_read_thread(void *arg) {
             LOGI("Packet not valid, unreferencing");
             av_packet_unref(packet);
         }
-        if (*is->backwards){
+        if (*is->backwards && is->pkt_index >= is->seek_target_index){
+            // the frames from the keyframe up to the target are read first
             seekTo_l(&is,is->pkt_index);
         }
     }
@@ -515,16 +648,18 @@ int packet_read_thread(void *arg) {
     return 0;
 }
 
-void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes) {
+void stream_seek(VideoState *is, int64_t pos, int64_t rel, int frame, int seek_by_bytes) {
     if (!is->seek_req) {
         LOGI("Seek requested to %"
                      PRId64, pos);
         is->seek_pos = pos;
+        is->seek_frame = frame;
         is->seek_rel = rel;
         is->seek_flags &= ~AVSEEK_FLAG_BYTE;
         if (seek_by_bytes)
             is->seek_flags |= AVSEEK_FLAG_BYTE;
         is->seek_req = 1;
+        wake_threads(is);
     }
 }
 
@@ -535,6 +670,7 @@ VideoState *create() {
     is->last_paused = -1;
     is->pkt_index = 0;
     is->fps_delay_ptr = 0;
+    is->read_ahead = 0;
     is->backwards = 0;
     is->seeking = 0;
     is->native_window = 0;
@@ -559,13 +695,7 @@ void disconnect(VideoState **ps) {
         }
 
         if (is->videoq.initialized == 1) {
-            if (is->videoq.first_pkt) {
-                free(is->videoq.first_pkt);
-            }
-
-            if (is->videoq.last_pkt) {
-                //free(is->videoq.last_pkt);
-            }
+            packet_queue_flush(is, &is->videoq);
 
             if (is->videoq.mutex) {
                 free(is->videoq.mutex);
@@ -710,18 +840,14 @@ int stop(VideoState **ps) {
          * audio queues are waiting for more data.  Make them stop
          * waiting and terminate normally.
          */
-
+        wake_threads(is);
+        LOGI("Signaling condition for stopping");
 
         if (is->parse_tid) {
             pthread_join(*(is->parse_tid), NULL);
             LOGI("Joining parse thread");
         }
 
-        if (is->videoq.initialized == 1) {
-            SDL_CondSignal(is->videoq.cond);
-            LOGI("Signaling condition for stopping");
-        }
-
         if (is->frame_decode_tid) {
             pthread_join(*(is->frame_decode_tid), NULL);
             LOGI("Joining decode thread");
@@ -745,6 +871,7 @@ int pause_l(VideoState **ps) {
 
     if (is) {
         is->paused = !is->paused;
+        wake_threads(is);
         return NO_ERROR;
     }
 
@@ -759,6 +886,7 @@ int stepForward(VideoState **ps) {
         is->step_req_display = 1;
         is->step_req_decode = 1;
         is->step_req_read = 1;
+        wake_threads(is);
         return NO_ERROR;
     }
 
@@ -773,6 +901,7 @@ int stepBackward(VideoState **ps) {
         is->step_req_display = 1;
         is->step_req_decode = 1;
         is->step_req_read = 1;
+        wake_threads(is);
         return NO_ERROR;
     }
 
@@ -800,7 +929,8 @@ int getVideoWidth(VideoState **ps, int *w) {
         return INVALID_OPERATION;
     }
 
-    *w = is->video_st->codec->width;
+    // the size as displayed
+    *w = is->rotation % 180 ? is->video_st->codec->height : is->video_st->codec->width;
 
     return NO_ERROR;
 }
@@ -812,7 +942,7 @@ int getVideoHeight(VideoState **ps, int *h) {
         return INVALID_OPERATION;
     }
 
-    *h = is->video_st->codec->height;
+    *h = is->rotation % 180 ? is->video_st->codec->width : is->video_st->codec->height;
 
     return NO_ERROR;
 }
@@ -953,13 +1083,7 @@ void clear_l(VideoState **ps) {
         is->video_st = NULL;
 
         if (is->videoq.initialized == 1) {
-            if (is->videoq.first_pkt) {
-                free(is->videoq.first_pkt);
-            }
-
-            if (is->videoq.last_pkt) {
-                //free(is->videoq.last_pkt);
-            }
+            packet_queue_flush(is, &is->videoq);
 
             if (is->videoq.mutex) {
                 free(is->videoq.mutex);
@@ -1038,7 +1162,7 @@ int seekTo_l(VideoState **ps, int fr_index) {
     VideoState *is = *ps;
 
     if (is) {
-        stream_seek(is, fr_index * is->frame_dur, fr_index * is->frame_dur, 0);//AVSEEK_FLAG_BACKWARD
+        stream_seek(is, fr_index * is->frame_dur, fr_index * is->frame_dur, fr_index, 0);//AVSEEK_FLAG_BACKWARD
         return NO_ERROR;
     }
 
@@ -1126,6 +1250,8 @@ int prepareAsync_l(VideoState **ps) {
         }
 
         set_rotation(is->pFormatCtx, is->video_st);
+        AVDictionaryEntry *rotate_tag = av_dict_get(is->pFormatCtx->metadata, ROTATE, NULL, AV_DICT_MATCH_CASE);
+        is->rotation = rotate_tag ? ((atoi(rotate_tag->value) % 360) + 360) % 360 : 0;
         set_framerate(is->pFormatCtx, is->video_st);
         set_filesize(is->pFormatCtx);
         set_chapter_count(is->pFormatCtx);
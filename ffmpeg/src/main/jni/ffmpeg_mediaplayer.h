@@ -11,6 +11,7 @@
 #include <libavutil/time.h>
 #include <libavutil/dict.h>
 #include <libavutil/avassert.h>
+#include <libavutil/display.h>
 
 #include <android/native_window_jni.h>
 
@@ -37,7 +38,10 @@
 #define LOGI(format, ...)  printf("FFMPEG_MEDIAPLAYER I " format "\n", ##__VA_ARGS__)
 #endif
 
-#define MAX_VIDEOQ_NR (1)
+#define PACKET_QUEUE_SLOTS 64           // power of two
+#define MAX_READ_AHEAD (PACKET_QUEUE_SLOTS - 4) // leaves room for the flush, eof and exit packets
+#define DEFAULT_READ_AHEAD 1
+#define CACHE_LINE_SIZE 64
 #define VIDEO_PICTURE_QUEUE_SIZE 2 //TODO 1 only but make a flag
 
 typedef enum media_event_type {
@@ -68,21 +72,37 @@ typedef enum {
     MEDIA_PLAYER_STOPPED            = 1 << 4
 } media_player_states;
 
+typedef struct PacketSlot {
+  AVPacket pkt;
+  int index;
+} PacketSlot;
+
+/*
+ * Single producer, single consumer ring of packets: the read thread puts, the decode thread gets.
+ * Each position is written by one side only, released once its slot is filled or emptied and acquired
+ * by the other side, so a packet moves without a lock or an allocation. The mutex and condition are
+ * only used to sleep on an empty or a full ring, sleepers counts the threads doing so.
+ */
 typedef struct PacketQueue {
   SDL_Window     *screen;
   SDL_Renderer *renderer;
   SDL_Texture *texture;
   int initialized;
-  AVPacketList *first_pkt, *last_pkt;
-  int nb_packets;
-  int size;
+  PacketSlot slots[PACKET_QUEUE_SLOTS];
+  uint32_t write_pos;                                   // read thread only
+  char write_pad[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  uint32_t read_pos;                                    // decode thread only
+  char read_pad[CACHE_LINE_SIZE - sizeof(uint32_t)];
+  int sleepers;
   SDL_mutex *mutex;
   SDL_cond *cond;
 } PacketQueue;
 
 typedef struct Picture {
 	int linesize;
-	void *buffer;
+	void *buffer; /* rgba, reused by every frame of the same size */
+	int width, height; /* size the buffer was allocated for */
+	int rotation; /* clockwise, in degrees, applied when displayed */
 } Picture;
 
 typedef struct VideoPicture {
@@ -101,6 +121,8 @@ typedef struct VideoState {
   int             seek_flags;
   int64_t         seek_pos;
   int64_t         seek_rel;
+  int             seek_frame;        // frame asked by seekTo, -1 for a time
+  int             seek_target_index; // sample asked by the last seek, the read may start at an earlier keyframe
 
     int step_req_read;
     int step_req_decode;
@@ -147,11 +169,13 @@ typedef struct VideoState {
 
   size_t *native_window;
   int *fps_delay_ptr;
+  int *read_ahead;   // packets read before the decode thread asks for them, DEFAULT_READ_AHEAD if unset
   unsigned char *avbuffer;
   int *backwards;
   int *seeking;
   int64_t frame_count;
   int64_t frame_dur;
+  int rotation; /* from the track header, used for frames without their own orientation */
 } VideoState;
 
 struct AVDictionary {
@@ -0,0 +1,69 @@
+#include "frame_metadata.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+
+#define FRAME_METADATA_VERSION 1
+#define FRAME_METADATA_LOCATION_SIZE 24
+
+const uint8_t FRAME_METADATA_UUID[16] = {
+        'O', 'S', 'V', '-', 'L', 'O', 'C', 'A', 'T', 'I', 'O', 'N', '-', 'S', 'E', 'I'
+};
+
+int frame_metadata_add_sei(AVPacket *pkt, int payload_type, const uint8_t *payload, int size) {
+    uint8_t rbsp[256];
+    uint8_t nal[4 + 1 + sizeof(rbsp) * 3 / 2];
+    int i, rbsp_size = 0, nal_size = 0, zeros = 0;
+    if (size < 0 || size > 250) {
+        return -1;
+    }
+    rbsp[rbsp_size++] = (uint8_t) payload_type;
+    rbsp[rbsp_size++] = (uint8_t) size;
+    memcpy(rbsp + rbsp_size, payload, (size_t) size);
+    rbsp_size += size;
+    rbsp[rbsp_size++] = 0x80;   // rbsp trailing bits
+
+    nal[nal_size++] = 0;
+    nal[nal_size++] = 0;
+    nal[nal_size++] = 0;
+    nal[nal_size++] = 1;
+    nal[nal_size++] = 0x06;     // nal_ref_idc 0, nal_unit_type SEI
+    for (i = 0; i < rbsp_size; i++) {
+        // emulation prevention, the payload must not contain a start code
+        if (zeros == 2 && rbsp[i] <= 3) {
+            nal[nal_size++] = 3;
+            zeros = 0;
+        }
+        nal[nal_size++] = rbsp[i];
+        zeros = rbsp[i] ? 0 : zeros + 1;
+    }
+
+    AVPacket out;
+    if (av_new_packet(&out, pkt->size + nal_size) < 0) {
+        return -1;
+    }
+    memcpy(out.data, nal, (size_t) nal_size);
+    memcpy(out.data + nal_size, pkt->data, (size_t) pkt->size);
+    av_packet_copy_props(&out, pkt);
+    av_packet_unref(pkt);
+    av_packet_move_ref(pkt, &out);
+    return 0;
+}
+
+int frame_metadata_add_location(AVPacket *pkt, const FrameLocation *location) {
+    uint8_t payload[sizeof(FRAME_METADATA_UUID) + FRAME_METADATA_LOCATION_SIZE];
+    uint8_t *p = payload + sizeof(FRAME_METADATA_UUID);
+    memcpy(payload, FRAME_METADATA_UUID, sizeof(FRAME_METADATA_UUID));
+    p[0] = FRAME_METADATA_VERSION;
+    p[1] = (uint8_t) location->flags;
+    AV_WB32(p + 2, (uint32_t) (int32_t) lrint(av_clipd(location->latitude, -90, 90) * 1e7));
+    AV_WB32(p + 6, (uint32_t) (int32_t) lrint(av_clipd(location->longitude, -180, 180) * 1e7));
+    AV_WB16(p + 10, (uint16_t) lrint(av_clipd(fmod(location->bearing + 360, 360), 0, 359.99) * 100));
+    AV_WB16(p + 12, (uint16_t) lrint(av_clipd(location->speed, 0, 655.35) * 100));
+    AV_WB16(p + 14, (uint16_t) lrint(av_clipd(location->accuracy, 0, 655.35) * 100));
+    AV_WB64(p + 16, (uint64_t) location->time);
+    return frame_metadata_add_sei(pkt, 5, payload, sizeof(payload));
+}
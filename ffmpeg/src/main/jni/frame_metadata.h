@@ -0,0 +1,43 @@
+#ifndef FRAME_METADATA_H_
+#define FRAME_METADATA_H_
+
+#include <stdint.h>
+
+#include "libavcodec/avcodec.h"
+
+#define FRAME_METADATA_HAS_POSITION 1
+#define FRAME_METADATA_HAS_BEARING 2
+#define FRAME_METADATA_HAS_SPEED 4
+#define FRAME_METADATA_HAS_ACCURACY 8
+
+/*
+ * Location of a frame, written into the h264 stream as a user data unregistered SEI (payload type 5)
+ * in front of the frame's slices. The samples are timed by the pts of their frame and are part of
+ * the video track, decoders skip them. The payload is FRAME_METADATA_UUID followed by, big endian:
+ *   u8  version, 1
+ *   u8  flags, FRAME_METADATA_HAS_*
+ *   s32 latitude, 1e-7 degrees
+ *   s32 longitude, 1e-7 degrees
+ *   u16 bearing, 0.01 degrees
+ *   u16 speed, cm/s
+ *   u16 accuracy, cm
+ *   s64 time of the fix, ms since the epoch
+ */
+typedef struct FrameLocation {
+    int flags;              // 0 when no location was given
+    double latitude;
+    double longitude;
+    float bearing;
+    float speed;            // meters per second
+    float accuracy;         // meters
+    int64_t time;
+} FrameLocation;
+
+extern const uint8_t FRAME_METADATA_UUID[16];
+
+/* Prepends a SEI NAL unit with the given payload to an annex b packet. */
+int frame_metadata_add_sei(AVPacket *pkt, int payload_type, const uint8_t *payload, int size);
+
+int frame_metadata_add_location(AVPacket *pkt, const FrameLocation *location);
+
+#endif /* FRAME_METADATA_H_ */
@@ -0,0 +1,85 @@
+#include "frame_pool.h"
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#define FRAME_POOL_ALIGN 32
+
+FramePool *frame_pool_create(enum AVPixelFormat format, int width, int height) {
+    int i;
+    int chroma_height = (height + 1) >> 1;
+    if (format != AV_PIX_FMT_YUV420P && format != AV_PIX_FMT_YUVJ420P) {
+        return NULL;
+    }
+    FramePool *p = av_mallocz(sizeof(FramePool));
+    if (!p) {
+        return NULL;
+    }
+    p->format = format;
+    p->width = width;
+    p->height = height;
+    p->linesize[0] = FFALIGN(width, FRAME_POOL_ALIGN);
+    p->linesize[1] = p->linesize[2] = FFALIGN((width + 1) >> 1, FRAME_POOL_ALIGN);
+    for (i = 0; i < 3; i++) {
+        int rows = i ? chroma_height : height;
+        // the simd kernels may read a little past the last row
+        p->pools[i] = av_buffer_pool_init(p->linesize[i] * rows + FRAME_POOL_ALIGN, av_buffer_alloc);
+        if (!p->pools[i]) {
+            frame_pool_free(&p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+void frame_pool_free(FramePool **pp) {
+    int i;
+    FramePool *p = *pp;
+    if (!p) {
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        av_buffer_pool_uninit(&p->pools[i]);
+    }
+    av_freep(pp);
+}
+
+int frame_pool_matches(FramePool *p, enum AVPixelFormat format, int width, int height) {
+    return p && p->format == format && p->width == width && p->height == height;
+}
+
+int frame_pool_ensure(FramePool **pp, enum AVPixelFormat format, int width, int height) {
+    if (frame_pool_matches(*pp, format, width, height)) {
+        return 0;
+    }
+    // frames still out keep their planes, the old pools are released with the last of them
+    frame_pool_free(pp);
+    *pp = frame_pool_create(format, width, height);
+    return *pp ? 0 : -1;
+}
+
+AVFrame *frame_pool_get(FramePool *p) {
+    AVFrame *frame = av_frame_alloc();
+    if (frame && frame_pool_get_buffer(p, frame) < 0) {
+        av_frame_free(&frame);
+    }
+    return frame;
+}
+
+int frame_pool_get_buffer(FramePool *p, AVFrame *frame) {
+    int i;
+    frame->format = p->format;
+    frame->width = p->width;
+    frame->height = p->height;
+    for (i = 0; i < 3; i++) {
+        frame->buf[i] = av_buffer_pool_get(p->pools[i]);
+        if (!frame->buf[i]) {
+            av_frame_unref(frame);
+            return -1;
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = p->linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include "libavutil/buffer.h"
+#include "libavutil/frame.h"
+#include "libavutil/pixfmt.h"
+
+/*
+ * Recycles the planes of fixed size YUV420P frames, so the per frame work of the encoder
+ * does not allocate. Frames taken from the pool are ordinary reference counted AVFrames,
+ * their planes go back to the pool when the last reference is gone, from any thread.
+ */
+typedef struct FramePool {
+    AVBufferPool *pools[3];
+    int linesize[3];
+    int width;
+    int height;
+    enum AVPixelFormat format;
+} FramePool;
+
+FramePool *frame_pool_create(enum AVPixelFormat format, int width, int height);
+
+/* The pool is released once every frame taken from it was freed. */
+void frame_pool_free(FramePool **pp);
+
+int frame_pool_matches(FramePool *p, enum AVPixelFormat format, int width, int height);
+
+/* Replaces *pp by a pool of the given format and size unless it already is one. */
+int frame_pool_ensure(FramePool **pp, enum AVPixelFormat format, int width, int height);
+
+AVFrame *frame_pool_get(FramePool *p);
+
+/* Gives planes from the pool to an empty frame, so the AVFrame itself can be reused too. */
+int frame_pool_get_buffer(FramePool *p, AVFrame *frame);
+
+#endif /* FRAME_POOL_H_ */
@@ -18,6 +18,7 @@ MediaPlayer::MediaPlayer() {
     native_window = NULL;
     mBackwards = 0;
     mSeeking = 0;
+    mReadAhead = DEFAULT_READ_AHEAD;
     mVideoWidth = mVideoHeight = 0;
 }
 
@@ -207,6 +208,7 @@ status_t MediaPlayer::setDataSource(const char *urls[], int size) {
             state->fps_delay_ptr = &mFpsDelay;
             state->backwards = &mBackwards;
             state->seeking = &mSeeking;
+            state->read_ahead = &mReadAhead;
             state->native_window = (size_t *) &native_window;
             setDataSource(state);
             status_t ret = ::prepare(&state);
@@ -214,6 +216,19 @@ status_t MediaPlayer::setDataSource(const char *urls[], int size) {
             if (ret != NO_ERROR) {
                 if (ret == AVERROR_INVALIDDATA && !triedFix) {
                     triedFix = 1;
+                    std::string truncated(state->filename);
+                    truncated.erase(0,7);
+                    // the encoder's journal rebuilds the file by itself, without a neighbour to copy from
+                    int recovered = segment_index_recover(truncated.c_str());
+                    if (recovered > 0) {
+                        LOGI("Mp4 file truncated, rebuilt %i frames from its journal", recovered);
+                        ::disconnect(&state);
+                        states.pop_back();
+                        if (previous != NULL) {
+                            previous->next = NULL;
+                        }
+                        goto beginning;
+                    }
                     VideoState* vs;
                     if (state->previous){
                         vs = (VideoState *) state->previous;
@@ -679,6 +694,12 @@ int MediaPlayer::seeking(bool started) {
     return OK;
 }
 
+int MediaPlayer::setReadAhead(int packets) {
+    // read by the read threads on their next packet
+    mReadAhead = packets;
+    return OK;
+}
+
 
 
 
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include "untrunc/mp4.h"
 #include "untrunc/atom.h"
+#include "segment_index.h"
 
 #ifdef ANDROID
 #include <android/log.h>
@@ -66,6 +67,7 @@ public:
     int                         mFpsDelay;
     int                         mBackwards;
     int                         mSeeking;
+    int                         mReadAhead;
     ANativeWindow               *native_window;
 
     int stepFrame(bool forward);
@@ -74,6 +76,8 @@ public:
 
     int seeking(bool i);
 
+    int setReadAhead(int packets);
+
 private:
             void            clear_l();
             void            jumpTo(int fileIndex);
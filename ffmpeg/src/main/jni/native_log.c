@@ -0,0 +1,196 @@
+#include "native_log.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libavutil/common.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+
+#define NATIVE_LOG_FLUSH_INTERVAL_MS 200
+
+/*
+ * Bounded multi producer queue: a slot whose seq equals the write position is free,
+ * seq == position + 1 means it holds a line for the reader.
+ */
+typedef struct NativeLogSlot {
+    uint32_t seq;
+    int len;
+    char text[NATIVE_LOG_LINE_SIZE];
+} NativeLogSlot;
+
+struct NativeLog {
+    NativeLogSlot slots[NATIVE_LOG_SLOTS];
+    uint32_t enqueue_pos;       // shared by the producers
+    uint32_t dequeue_pos;       // flusher thread only
+    uint32_t dropped;
+    int stop;
+    int sleeping;               // the flusher found the ring empty and waits for a producer
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char path[1024];
+    int64_t max_size;
+    int64_t size;
+    FILE *file;
+    pthread_t tid;
+};
+
+void native_log_vprintf(NativeLog *log, int level, const char *fmt, va_list vl) {
+    if (!log || level > av_log_get_level()) {
+        return;
+    }
+    uint32_t pos = __atomic_load_n(&log->enqueue_pos, __ATOMIC_RELAXED);
+    NativeLogSlot *slot;
+    for (; ;) {
+        slot = &log->slots[pos & (NATIVE_LOG_SLOTS - 1)];
+        int32_t dif = (int32_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&log->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // full, the flusher is behind
+            __atomic_add_fetch(&log->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&log->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    int len = vsnprintf(slot->text, sizeof(slot->text), fmt, vl);
+    slot->len = len < 0 ? 0 : FFMIN(len, NATIVE_LOG_LINE_SIZE - 1);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    // only the first line after the ring went empty takes the lock, paired with the fence of wait_for_lines
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log->sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&log->sleeping, 0, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&log->mutex);
+        pthread_cond_signal(&log->cond);
+        pthread_mutex_unlock(&log->mutex);
+    }
+}
+
+static void rotate_file(NativeLog *log) {
+    char old_path[1040];
+    fclose(log->file);
+    log->file = NULL;
+    snprintf(old_path, sizeof(old_path), "%s.1", log->path);
+    rename(log->path, old_path);
+}
+
+static void write_text(NativeLog *log, const char *text, int len) {
+    if (!log->file) {
+        // the storage may not be mounted yet, retried on the next flush
+        log->file = fopen(log->path, "a");
+        if (!log->file) {
+            return;
+        }
+        fseek(log->file, 0, SEEK_END);
+        log->size = ftell(log->file);
+    }
+    log->size += fwrite(text, 1, (size_t) len, log->file);
+    if (log->size >= log->max_size) {
+        rotate_file(log);
+    }
+}
+
+/* Writes every line available, returns the number of lines. */
+static int drain(NativeLog *log) {
+    int lines = 0;
+    uint32_t dropped = __atomic_exchange_n(&log->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        char text[64];
+        write_text(log, text, snprintf(text, sizeof(text), "... %u log lines dropped\n", dropped));
+    }
+    for (; ;) {
+        NativeLogSlot *slot = &log->slots[log->dequeue_pos & (NATIVE_LOG_SLOTS - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log->dequeue_pos + 1) {
+            break;
+        }
+        write_text(log, slot->text, slot->len);
+        __atomic_store_n(&slot->seq, log->dequeue_pos + NATIVE_LOG_SLOTS, __ATOMIC_RELEASE);
+        log->dequeue_pos++;
+        lines++;
+    }
+    if (log->file && (lines || dropped)) {
+        fflush(log->file);
+    }
+    return lines;
+}
+
+/* The mutex is held. Sleeps until a producer publishes a line into the empty ring, or the log is closed. */
+static void wait_for_lines(NativeLog *log) {
+    __atomic_store_n(&log->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    NativeLogSlot *slot = &log->slots[log->dequeue_pos & (NATIVE_LOG_SLOTS - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log->dequeue_pos + 1 && !log->stop) {
+        pthread_cond_wait(&log->cond, &log->mutex);
+    }
+    __atomic_store_n(&log->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static void *flush_thread(void *arg) {
+    NativeLog *log = arg;
+    struct timespec deadline;
+    pthread_mutex_lock(&log->mutex);
+    while (!log->stop) {
+        pthread_mutex_unlock(&log->mutex);
+        drain(log);
+        pthread_mutex_lock(&log->mutex);
+        wait_for_lines(log);
+        if (log->stop) {
+            break;
+        }
+        // lets the lines logged together arrive, they are written with one flush
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += NATIVE_LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&log->cond, &log->mutex, &deadline);
+    }
+    pthread_mutex_unlock(&log->mutex);
+    drain(log);
+    return NULL;
+}
+
+NativeLog *native_log_create(const char *path, int64_t max_size) {
+    uint32_t i;
+    NativeLog *log = av_mallocz(sizeof(NativeLog));
+    if (!log) {
+        return NULL;
+    }
+    for (i = 0; i < NATIVE_LOG_SLOTS; i++) {
+        log->slots[i].seq = i;
+    }
+    snprintf(log->path, sizeof(log->path), "%s", path);
+    log->max_size = max_size > 0 ? max_size : NATIVE_LOG_MAX_SIZE;
+    pthread_mutex_init(&log->mutex, NULL);
+    pthread_cond_init(&log->cond, NULL);
+    if (pthread_create(&log->tid, NULL, flush_thread, log) != 0) {
+        pthread_mutex_destroy(&log->mutex);
+        pthread_cond_destroy(&log->cond);
+        av_free(log);
+        return NULL;
+    }
+    return log;
+}
+
+void native_log_free(NativeLog **plog) {
+    NativeLog *log = *plog;
+    if (!log) {
+        return;
+    }
+    pthread_mutex_lock(&log->mutex);
+    log->stop = 1;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    pthread_join(log->tid, NULL);
+    if (log->file) {
+        fclose(log->file);
+    }
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->cond);
+    av_freep(plog);
+}
@@ -0,0 +1,36 @@
+#ifndef NATIVE_LOG_H_
+#define NATIVE_LOG_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NATIVE_LOG_SLOTS 512            // power of two
+#define NATIVE_LOG_LINE_SIZE 256
+#define NATIVE_LOG_MAX_SIZE (4 << 20)
+
+/*
+ * Log file fed from any thread without storage io: lines are formatted into a bounded ring
+ * and a background thread appends them to the file. The thread sleeps while nothing is logged,
+ * the first line into the empty ring wakes it. Lines are dropped (and counted) when the ring is
+ * full, a logging thread never waits for the file. Once the file grows past
+ * max_size it is renamed to "<path>.1" and a new one is started.
+ */
+typedef struct NativeLog NativeLog;
+
+NativeLog *native_log_create(const char *path, int64_t max_size);
+
+/* Lines above the av_log level are filtered before being formatted. A NULL log drops everything. */
+void native_log_vprintf(NativeLog *log, int level, const char *fmt, va_list vl);
+
+/* Writes the lines left in the ring and closes the file. */
+void native_log_free(NativeLog **plog);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NATIVE_LOG_H_ */
@@ -0,0 +1,113 @@
+#include "rate_control.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#define RATE_CONTROL_SUBSAMPLE 4        // luma compared on one pixel out of 4 in both directions
+#define RATE_CONTROL_SAD_FLOOR 4.0      // cost of a frame not moving at all, relative to the sad
+#define RATE_CONTROL_DEBT_FRAMES 32     // frames over which an excess is paid back
+#define RATE_CONTROL_MODEL_WEIGHT 0.125
+
+int rate_control_init(RateControl *rc, int64_t budget_per_km) {
+    memset(rc, 0, sizeof(RateControl));
+    rc->budget_per_km = budget_per_km;
+    rc->speed = -1;
+    return pthread_mutex_init(&rc->mutex, NULL) == 0 ? 0 : -1;
+}
+
+void rate_control_uninit(RateControl *rc) {
+    av_freep(&rc->luma);
+    pthread_mutex_destroy(&rc->mutex);
+}
+
+void rate_control_set_speed(RateControl *rc, float speed) {
+    pthread_mutex_lock(&rc->mutex);
+    rc->speed = speed;
+    pthread_mutex_unlock(&rc->mutex);
+}
+
+float rate_control_speed(RateControl *rc) {
+    pthread_mutex_lock(&rc->mutex);
+    float speed = rc->speed;
+    pthread_mutex_unlock(&rc->mutex);
+    return speed;
+}
+
+float rate_control_complexity(RateControl *rc, const AVFrame *frame) {
+    int width = frame->width / RATE_CONTROL_SUBSAMPLE;
+    int height = frame->height / RATE_CONTROL_SUBSAMPLE;
+    int x, y, first = 0;
+    int64_t sad = 0;
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+    if (!rc->luma || width != rc->luma_width || height != rc->luma_height) {
+        av_freep(&rc->luma);
+        rc->luma = av_malloc((size_t) width * height);
+        if (!rc->luma) {
+            return 0;
+        }
+        rc->luma_width = width;
+        rc->luma_height = height;
+        first = 1;
+    }
+    for (y = 0; y < height; y++) {
+        const uint8_t *src = frame->data[0] + (int64_t) y * RATE_CONTROL_SUBSAMPLE * frame->linesize[0];
+        uint8_t *prev = rc->luma + y * width;
+        for (x = 0; x < width; x++) {
+            uint8_t v = src[x * RATE_CONTROL_SUBSAMPLE];
+            sad += abs(v - prev[x]);
+            prev[x] = v;
+        }
+    }
+    // nothing to compare the first frame with, it is as costly as a key frame anyway
+    return first ? 0 : (float) ((double) sad / ((int64_t) width * height));
+}
+
+/* Bytes the budget allows for the distance driven during a frame. */
+static double frame_target(RateControl *rc, float speed, double duration) {
+    return (double) rc->budget_per_km * speed * duration / 1000;
+}
+
+float rate_control_crf(RateControl *rc, float speed, float complexity, double duration, int keyframe) {
+    if (!rc->budget_per_km) {
+        return RATE_CONTROL_CRF_DEFAULT;
+    }
+    pthread_mutex_lock(&rc->mutex);
+    double model = rc->model[keyframe] > 0 ? rc->model[keyframe] : rc->model[!keyframe];
+    double target = frame_target(rc, speed, duration) - rc->debt / RATE_CONTROL_DEBT_FRAMES;
+    pthread_mutex_unlock(&rc->mutex);
+    if (speed < 0 || model <= 0) {
+        return RATE_CONTROL_CRF_DEFAULT;
+    }
+    if (target < 1) {
+        return RATE_CONTROL_CRF_MAX;
+    }
+    // the size halves every 6 crf steps, log2 is missing before android 18
+    double crf = 6 * log(model * (RATE_CONTROL_SAD_FLOOR + complexity) / target) / M_LN2;
+    // whole steps, every change reconfigures x264
+    return (float) av_clipd(round(crf), RATE_CONTROL_CRF_MIN, RATE_CONTROL_CRF_MAX);
+}
+
+void rate_control_update(RateControl *rc, float speed, float complexity, double duration, float crf, int keyframe, int size) {
+    if (!rc->budget_per_km || size <= 0) {
+        return;
+    }
+    double sample = size / ((RATE_CONTROL_SAD_FLOOR + complexity) * pow(2, -crf / 6.0));
+    pthread_mutex_lock(&rc->mutex);
+    if (rc->model[keyframe] > 0) {
+        rc->model[keyframe] += (sample - rc->model[keyframe]) * RATE_CONTROL_MODEL_WEIGHT;
+    } else {
+        rc->model[keyframe] = sample;
+    }
+    if (speed > 0) {
+        // standing still is already at the highest crf, what it costs is not paid back later
+        double bound = rc->budget_per_km / 4.0;
+        rc->debt = av_clipd(rc->debt + size - frame_target(rc, speed, duration), -bound, bound);
+    }
+    pthread_mutex_unlock(&rc->mutex);
+}
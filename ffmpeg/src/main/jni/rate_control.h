@@ -0,0 +1,47 @@
+#ifndef RATE_CONTROL_H_
+#define RATE_CONTROL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "libavutil/frame.h"
+
+#define RATE_CONTROL_CRF_MIN 18
+#define RATE_CONTROL_CRF_MAX 32         // signs stay legible up to here
+#define RATE_CONTROL_CRF_DEFAULT 23     // used until the speed is known
+
+/*
+ * Picks the x264 crf of every frame so a recording spends about budget_per_km bytes per kilometre.
+ * The target of a frame is the share of the budget for the distance driven during it, taken from the
+ * speed hint. A frame size model, size = model * (floor + sad) * 2^(-crf / 6), is learned from the
+ * encoded frames, sad being the mean luma difference with the previous frame. Standing still gets
+ * the highest crf and is left out of the budget.
+ */
+typedef struct RateControl {
+    int64_t budget_per_km;      // bytes, 0 when the rate control is off
+    pthread_mutex_t mutex;      // guards the fields below, the speed is set by the app threads
+    float speed;                // meters per second, negative when unknown
+    double model[2];            // size model of p and key frames, 0 until a frame was encoded
+    double debt;                // bytes written over the targets, bounded
+    // subsampled luma of the previous frame, rate_control_complexity only
+    uint8_t *luma;
+    int luma_width;
+    int luma_height;
+} RateControl;
+
+int rate_control_init(RateControl *rc, int64_t budget_per_km);
+void rate_control_uninit(RateControl *rc);
+
+void rate_control_set_speed(RateControl *rc, float speed);
+float rate_control_speed(RateControl *rc);
+
+/* Mean absolute luma difference with the previous frame given, frames have to be given in order. */
+float rate_control_complexity(RateControl *rc, const AVFrame *frame);
+
+/* The crf of a frame lasting duration seconds. */
+float rate_control_crf(RateControl *rc, float speed, float complexity, double duration, int keyframe);
+
+/* Learns from an encoded frame, in frame order. */
+void rate_control_update(RateControl *rc, float speed, float complexity, double duration, float crf, int keyframe, int size);
+
+#endif /* RATE_CONTROL_H_ */
@@ -0,0 +1,177 @@
+#include "rotate.h"
+
+#include "libavutil/common.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ROTATE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ROTATE_SSE2 1
+#endif
+
+#define ROTATE_TILE 32
+
+/*
+ * Writes column m of the 8x8 block made of rows[0..7] as destination row m,
+ * dst_stride is negative when the destination rows go upwards.
+ */
+static void transpose_block(const uint8_t *const rows[8], uint8_t *dst, int dst_stride) {
+#if defined(ROTATE_NEON)
+    uint8x8x2_t t0 = vtrn_u8(vld1_u8(rows[0]), vld1_u8(rows[1]));
+    uint8x8x2_t t1 = vtrn_u8(vld1_u8(rows[2]), vld1_u8(rows[3]));
+    uint8x8x2_t t2 = vtrn_u8(vld1_u8(rows[4]), vld1_u8(rows[5]));
+    uint8x8x2_t t3 = vtrn_u8(vld1_u8(rows[6]), vld1_u8(rows[7]));
+    uint16x4x2_t u0 = vtrn_u16(vreinterpret_u16_u8(t0.val[0]), vreinterpret_u16_u8(t1.val[0]));
+    uint16x4x2_t u1 = vtrn_u16(vreinterpret_u16_u8(t0.val[1]), vreinterpret_u16_u8(t1.val[1]));
+    uint16x4x2_t u2 = vtrn_u16(vreinterpret_u16_u8(t2.val[0]), vreinterpret_u16_u8(t3.val[0]));
+    uint16x4x2_t u3 = vtrn_u16(vreinterpret_u16_u8(t2.val[1]), vreinterpret_u16_u8(t3.val[1]));
+    uint32x2x2_t v0 = vtrn_u32(vreinterpret_u32_u16(u0.val[0]), vreinterpret_u32_u16(u2.val[0]));
+    uint32x2x2_t v1 = vtrn_u32(vreinterpret_u32_u16(u1.val[0]), vreinterpret_u32_u16(u3.val[0]));
+    uint32x2x2_t v2 = vtrn_u32(vreinterpret_u32_u16(u0.val[1]), vreinterpret_u32_u16(u2.val[1]));
+    uint32x2x2_t v3 = vtrn_u32(vreinterpret_u32_u16(u1.val[1]), vreinterpret_u32_u16(u3.val[1]));
+    vst1_u8(dst, vreinterpret_u8_u32(v0.val[0]));
+    vst1_u8(dst + dst_stride, vreinterpret_u8_u32(v1.val[0]));
+    vst1_u8(dst + 2 * dst_stride, vreinterpret_u8_u32(v2.val[0]));
+    vst1_u8(dst + 3 * dst_stride, vreinterpret_u8_u32(v3.val[0]));
+    vst1_u8(dst + 4 * dst_stride, vreinterpret_u8_u32(v0.val[1]));
+    vst1_u8(dst + 5 * dst_stride, vreinterpret_u8_u32(v1.val[1]));
+    vst1_u8(dst + 6 * dst_stride, vreinterpret_u8_u32(v2.val[1]));
+    vst1_u8(dst + 7 * dst_stride, vreinterpret_u8_u32(v3.val[1]));
+#elif defined(ROTATE_SSE2)
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) rows[0]), _mm_loadl_epi64((const __m128i *) rows[1]));
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) rows[2]), _mm_loadl_epi64((const __m128i *) rows[3]));
+    __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) rows[4]), _mm_loadl_epi64((const __m128i *) rows[5]));
+    __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) rows[6]), _mm_loadl_epi64((const __m128i *) rows[7]));
+    // columns 0-3 and 4-7 of rows 0-3, then of rows 4-7
+    __m128i e = _mm_unpacklo_epi16(a, b);
+    __m128i f = _mm_unpackhi_epi16(a, b);
+    __m128i g = _mm_unpacklo_epi16(c, d);
+    __m128i h = _mm_unpackhi_epi16(c, d);
+    __m128i c01 = _mm_unpacklo_epi32(e, g);
+    __m128i c23 = _mm_unpackhi_epi32(e, g);
+    __m128i c45 = _mm_unpacklo_epi32(f, h);
+    __m128i c67 = _mm_unpackhi_epi32(f, h);
+    _mm_storel_epi64((__m128i *) dst, c01);
+    _mm_storel_epi64((__m128i *) (dst + dst_stride), _mm_srli_si128(c01, 8));
+    _mm_storel_epi64((__m128i *) (dst + 2 * dst_stride), c23);
+    _mm_storel_epi64((__m128i *) (dst + 3 * dst_stride), _mm_srli_si128(c23, 8));
+    _mm_storel_epi64((__m128i *) (dst + 4 * dst_stride), c45);
+    _mm_storel_epi64((__m128i *) (dst + 5 * dst_stride), _mm_srli_si128(c45, 8));
+    _mm_storel_epi64((__m128i *) (dst + 6 * dst_stride), c67);
+    _mm_storel_epi64((__m128i *) (dst + 7 * dst_stride), _mm_srli_si128(c67, 8));
+#else
+    int m, k;
+    for (m = 0; m < 8; m++) {
+        for (k = 0; k < 8; k++) {
+            dst[m * dst_stride + k] = rows[k][m];
+        }
+    }
+#endif
+}
+
+/* Quarter turn, clockwise when cw is set, counter clockwise otherwise. */
+static void rotate_plane_quarter(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height, int cw) {
+    const uint8_t *rows[8];
+    int width8 = width & ~7;
+    int height8 = height & ~7;
+    int tx, ty, r, c, k;
+
+    for (ty = 0; ty < height8; ty += ROTATE_TILE) {
+        int ty_end = FFMIN(ty + ROTATE_TILE, height8);
+        for (tx = 0; tx < width8; tx += ROTATE_TILE) {
+            int tx_end = FFMIN(tx + ROTATE_TILE, width8);
+            for (r = ty; r < ty_end; r += 8) {
+                for (c = tx; c < tx_end; c += 8) {
+                    if (cw) {
+                        // source row r + 7 becomes the first destination column of the block
+                        for (k = 0; k < 8; k++) {
+                            rows[k] = src + (r + 7 - k) * src_stride + c;
+                        }
+                        transpose_block(rows, dst + c * dst_stride + (height - 8 - r), dst_stride);
+                    } else {
+                        // source column c becomes the last destination row of the block
+                        for (k = 0; k < 8; k++) {
+                            rows[k] = src + (r + k) * src_stride + c;
+                        }
+                        transpose_block(rows, dst + (width - 1 - c) * dst_stride + r, -dst_stride);
+                    }
+                }
+            }
+        }
+    }
+    // the right and bottom borders which do not fill a whole block
+    for (r = 0; r < height; r++) {
+        for (c = r < height8 ? width8 : 0; c < width; c++) {
+            if (cw) {
+                dst[c * dst_stride + (height - 1 - r)] = src[r * src_stride + c];
+            } else {
+                dst[(width - 1 - c) * dst_stride + r] = src[r * src_stride + c];
+            }
+        }
+    }
+}
+
+void rotate_plane_90(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    rotate_plane_quarter(src, src_stride, dst, dst_stride, width, height, 1);
+}
+
+void rotate_plane_270(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    rotate_plane_quarter(src, src_stride, dst, dst_stride, width, height, 0);
+}
+
+void rotate_plane_180(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    int r, i;
+    for (r = 0; r < height; r++) {
+        const uint8_t *s = src + (height - 1 - r) * src_stride;
+        uint8_t *d = dst + r * dst_stride;
+        i = 0;
+#if defined(ROTATE_NEON)
+        for (; i + 16 <= width; i += 16) {
+            uint8x16_t v = vrev64q_u8(vld1q_u8(s + width - 16 - i));
+            vst1q_u8(d + i, vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+        }
+#elif defined(ROTATE_SSE2)
+        for (; i + 16 <= width; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (s + width - 16 - i));
+            // swap the bytes of every word, then reverse the order of the words
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_si128((__m128i *) (d + i), v);
+        }
+#endif
+        for (; i < width; i++) {
+            d[i] = s[width - 1 - i];
+        }
+    }
+}
+
+int rotate_swaps_dimensions(int orientation) {
+    return orientation == 6 || orientation == 8;
+}
+
+int rotate_frame(const AVFrame *src, AVFrame *dst, int orientation) {
+    int i;
+    void (*rotate_plane)(const uint8_t *, int, uint8_t *, int, int, int);
+    switch (orientation) {
+        case 3:
+            rotate_plane = rotate_plane_180;
+            break;
+        case 6:
+            rotate_plane = rotate_plane_90;
+            break;
+        case 8:
+            rotate_plane = rotate_plane_270;
+            break;
+        default:
+            return -1;
+    }
+    for (i = 0; i < 3; i++) {
+        int width = i ? (src->width + 1) >> 1 : src->width;
+        int height = i ? (src->height + 1) >> 1 : src->height;
+        rotate_plane(src->data[i], src->linesize[i], dst->data[i], dst->linesize[i], width, height);
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef ROTATE_H_
+#define ROTATE_H_
+
+#include <stdint.h>
+#include "libavutil/frame.h"
+
+/*
+ * Lossless rotation of planar frames, replacing the transpose and flip filters.
+ * The quarter turns transpose 8x8 blocks in registers (NEON or SSE2, scalar elsewhere),
+ * walking the image in tiles small enough for the source rows and destination rows
+ * touched by a tile to stay in the cache.
+ */
+
+/* width and height are the source dimensions, the destination is height x width. */
+void rotate_plane_90(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+void rotate_plane_180(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+void rotate_plane_270(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/* Returns 1 for the exif orientations swapping the width and the height. */
+int rotate_swaps_dimensions(int orientation);
+
+/*
+ * Rotates a YUV420P frame according to an exif orientation (3, 6 or 8) into dst,
+ * which must already have buffers of the rotated size. Returns -1 for other orientations.
+ */
+int rotate_frame(const AVFrame *src, AVFrame *dst, int orientation);
+
+#endif /* ROTATE_H_ */
@@ -0,0 +1,239 @@
+#include "segment_index.h"
+
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+
+#define SEGMENT_INDEX_MAGIC "OSVI"
+#define SEGMENT_INDEX_VERSION 1
+#define SEGMENT_INDEX_HEADER_SIZE 28
+
+void segment_index_path(const char *mp4_path, char *out, size_t size) {
+    const char *dot = strrchr(mp4_path, '.');
+    const char *slash = strrchr(mp4_path, '/');
+    size_t len = dot && (!slash || dot > slash) ? (size_t) (dot - mp4_path) : strlen(mp4_path);
+    snprintf(out, size, "%.*s.idx", (int) len, mp4_path);
+}
+
+FILE *segment_index_create(const char *path, const SegmentIndexHeader *header) {
+    uint8_t buf[SEGMENT_INDEX_HEADER_SIZE];
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return NULL;
+    }
+    memcpy(buf, SEGMENT_INDEX_MAGIC, 4);
+    AV_WL32(buf + 4, SEGMENT_INDEX_VERSION);
+    AV_WL32(buf + 8, header->width);
+    AV_WL32(buf + 12, header->height);
+    AV_WL32(buf + 16, header->time_base_num);
+    AV_WL32(buf + 20, header->time_base_den);
+    AV_WL32(buf + 24, header->extradata_size);
+    if (fwrite(buf, sizeof(buf), 1, f) != 1 ||
+        (header->extradata_size > 0 && fwrite(header->extradata, header->extradata_size, 1, f) != 1) ||
+        fflush(f) != 0) {
+        fclose(f);
+        remove(path);
+        return NULL;
+    }
+    return f;
+}
+
+int segment_index_append(FILE *f, const SegmentIndexRecord *record) {
+    uint8_t buf[SEGMENT_INDEX_RECORD_SIZE];
+    AV_WL32(buf, record->frame_index);
+    AV_WL32(buf + 4, record->size);
+    AV_WL64(buf + 8, record->offset);
+    AV_WL64(buf + 16, record->pts);
+    AV_WL32(buf + 24, record->keyframe);
+    AV_WL32(buf + 28, 0);
+    // flushed every time, the journal is only useful if it survives the process
+    if (fwrite(buf, sizeof(buf), 1, f) != 1 || fflush(f) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+FILE *segment_index_open(const char *path, SegmentIndexHeader *header) {
+    uint8_t buf[SEGMENT_INDEX_HEADER_SIZE];
+    memset(header, 0, sizeof(SegmentIndexHeader));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    if (fread(buf, sizeof(buf), 1, f) != 1 || memcmp(buf, SEGMENT_INDEX_MAGIC, 4) != 0 ||
+        AV_RL32(buf + 4) != SEGMENT_INDEX_VERSION) {
+        goto fail;
+    }
+    header->width = AV_RL32(buf + 8);
+    header->height = AV_RL32(buf + 12);
+    header->time_base_num = AV_RL32(buf + 16);
+    header->time_base_den = AV_RL32(buf + 20);
+    header->extradata_size = AV_RL32(buf + 24);
+    if (header->extradata_size < 0 || header->extradata_size > 1 << 16 ||
+        header->time_base_num <= 0 || header->time_base_den <= 0) {
+        goto fail;
+    }
+    if (header->extradata_size > 0) {
+        header->extradata = av_mallocz(header->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!header->extradata || fread(header->extradata, header->extradata_size, 1, f) != 1) {
+            goto fail;
+        }
+    }
+    return f;
+
+    fail:
+    segment_index_header_free(header);
+    fclose(f);
+    return NULL;
+}
+
+void segment_index_header_free(SegmentIndexHeader *header) {
+    av_freep(&header->extradata);
+    header->extradata_size = 0;
+}
+
+int segment_index_read(FILE *f, SegmentIndexRecord *record) {
+    uint8_t buf[SEGMENT_INDEX_RECORD_SIZE];
+    if (fread(buf, sizeof(buf), 1, f) != 1) {
+        return 0;
+    }
+    record->frame_index = AV_RL32(buf);
+    record->size = AV_RL32(buf + 4);
+    record->offset = AV_RL64(buf + 8);
+    record->pts = AV_RL64(buf + 16);
+    record->keyframe = AV_RL32(buf + 24);
+    return 1;
+}
+
+/*
+ * The muxer stored the samples with 4 byte nal lengths, turns them back into annex b start codes
+ * (same size) so the muxer converts them again against the annex b extradata.
+ */
+static int to_annexb(uint8_t *data, int size) {
+    uint8_t *p = data;
+    uint8_t *end = data + size;
+    while (end - p >= 4) {
+        uint32_t len = AV_RB32(p);
+        if (len > (uint32_t) (end - p - 4)) {
+            return -1;
+        }
+        AV_WB32(p, 1);
+        p += 4 + len;
+    }
+    return p == end ? 0 : -1;
+}
+
+int segment_index_recover(const char *mp4_path) {
+    char idx_path[1024];
+    char tmp_path[1024];
+    SegmentIndexHeader header;
+    SegmentIndexRecord record, next;
+    AVFormatContext *ofmt_ctx = NULL;
+    AVStream *st;
+    AVPacket pkt;
+    uint8_t *data = NULL;
+    unsigned int data_size = 0;
+    int64_t file_size, duration = 1;
+    int have, has_next, frames = 0, ret = -1;
+    FILE *in = NULL;
+
+    segment_index_path(mp4_path, idx_path, sizeof(idx_path));
+    FILE *index = segment_index_open(idx_path, &header);
+    if (!index) {
+        return -1;
+    }
+    in = fopen(mp4_path, "rb");
+    if (!in || fseeko(in, 0, SEEK_END) != 0 || (file_size = ftello(in)) < 0) {
+        goto end;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", mp4_path);
+    avformat_alloc_output_context2(&ofmt_ctx, NULL, "mp4", tmp_path);
+    if (!ofmt_ctx || !(st = avformat_new_stream(ofmt_ctx, NULL))) {
+        goto end;
+    }
+    AVRational time_base = {header.time_base_num, header.time_base_den};
+    st->time_base = time_base;
+    st->codec->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codec->codec_id = AV_CODEC_ID_H264;
+    st->codec->width = header.width;
+    st->codec->height = header.height;
+    st->codec->time_base = time_base;
+    if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+        st->codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (header.extradata_size > 0) {
+        st->codec->extradata = av_mallocz(header.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!st->codec->extradata) {
+            goto end;
+        }
+        memcpy(st->codec->extradata, header.extradata, header.extradata_size);
+        st->codec->extradata_size = header.extradata_size;
+    }
+    if (avio_open(&ofmt_ctx->pb, tmp_path, AVIO_FLAG_WRITE) < 0) {
+        goto end;
+    }
+    if (avformat_write_header(ofmt_ctx, NULL) < 0) {
+        goto close;
+    }
+
+    have = segment_index_read(index, &record);
+    while (have) {
+        has_next = segment_index_read(index, &next);
+        // the last samples can be in the journal but still in the muxer's buffer when the process died
+        if (record.size <= 0 || record.offset < 0 || record.offset + record.size > file_size) {
+            break;
+        }
+        av_fast_padded_malloc(&data, &data_size, (size_t) record.size);
+        if (!data || fseeko(in, record.offset, SEEK_SET) != 0 ||
+            fread(data, (size_t) record.size, 1, in) != 1 || to_annexb(data, record.size) < 0) {
+            break;
+        }
+        if (has_next && next.pts > record.pts) {
+            duration = next.pts - record.pts;
+        }
+        av_init_packet(&pkt);
+        pkt.data = data;
+        pkt.size = record.size;
+        pkt.stream_index = st->index;
+        pkt.pts = pkt.dts = record.pts;
+        pkt.duration = duration;
+        pkt.flags = record.keyframe ? AV_PKT_FLAG_KEY : 0;
+        av_packet_rescale_ts(&pkt, time_base, st->time_base);
+        if (av_write_frame(ofmt_ctx, &pkt) < 0) {
+            break;
+        }
+        frames++;
+        record = next;
+        have = has_next;
+    }
+    if (frames > 0 && av_write_trailer(ofmt_ctx) == 0) {
+        ret = frames;
+    }
+
+    close:
+    avio_closep(&ofmt_ctx->pb);
+    if (ret > 0) {
+        fclose(in);
+        in = NULL;
+        if (rename(tmp_path, mp4_path) == 0) {
+            remove(idx_path);
+        } else {
+            ret = -1;
+        }
+    }
+    if (ret <= 0) {
+        remove(tmp_path);
+    }
+
+    end:
+    av_free(data);
+    avformat_free_context(ofmt_ctx);
+    if (in) {
+        fclose(in);
+    }
+    fclose(index);
+    segment_index_header_free(&header);
+    return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef SEGMENT_INDEX_H_
+#define SEGMENT_INDEX_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sample journal of a regular (non fragmented) mp4 segment, "N.idx" next to "N.mp4".
+ * The encoder appends one fixed size record per frame written to the mdat and removes the
+ * journal once the trailer is written, so a journal only survives an interrupted recording.
+ * The sample table of the truncated file can then be rebuilt from it without parsing the mdat.
+ *
+ * Layout, little endian: a header with the stream parameters and the h264 extradata,
+ * followed by SEGMENT_INDEX_RECORD_SIZE bytes records.
+ */
+#define SEGMENT_INDEX_RECORD_SIZE 32
+
+typedef struct SegmentIndexHeader {
+    int width;
+    int height;
+    int time_base_num;          // time base of the record pts, the mp4 track timescale
+    int time_base_den;
+    uint8_t *extradata;         // annex b sps/pps, owned by the header
+    int extradata_size;
+} SegmentIndexHeader;
+
+typedef struct SegmentIndexRecord {
+    int frame_index;
+    int size;                   // bytes in the file, after the muxer converted the packet
+    int64_t offset;             // absolute file offset of the sample
+    int64_t pts;
+    int keyframe;
+} SegmentIndexRecord;
+
+/* Writes the journal path of an mp4 file into out, the extension replaced by ".idx". */
+void segment_index_path(const char *mp4_path, char *out, size_t size);
+
+FILE *segment_index_create(const char *path, const SegmentIndexHeader *header);
+int segment_index_append(FILE *f, const SegmentIndexRecord *record);
+
+/* Opens a journal and reads its header, to be released with segment_index_header_free. */
+FILE *segment_index_open(const char *path, SegmentIndexHeader *header);
+void segment_index_header_free(SegmentIndexHeader *header);
+
+/* Returns 1 when a record was read, 0 at the end of the journal or on a partial record. */
+int segment_index_read(FILE *f, SegmentIndexRecord *record);
+
+/*
+ * Rewrites a truncated mp4 from its journal, keeping the samples that made it to the disk.
+ * No reference file is needed, the stream parameters come from the journal header.
+ * Returns the number of frames recovered, or a negative value on error.
+ */
+int segment_index_recover(const char *mp4_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEGMENT_INDEX_H_ */
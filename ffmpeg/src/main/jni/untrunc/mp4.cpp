@@ -33,6 +33,7 @@ extern "C" {
 #include "mp4.h"
 #include "atom.h"
 #include "file.h"
+#include "../segment_index.h"
 
 using namespace std;
 
@@ -281,9 +282,7 @@ void Mp4::parseTracks() {
 	}
 }
 
-void Mp4::repair(string filename) {
-
-
+BufferedAtom *Mp4::findMdat(string filename) {
 	File file;
 	if(!file.open(filename))
 		throw "Could not open file: " + filename;
@@ -317,6 +316,25 @@ void Mp4::repair(string filename) {
 		//mdat->content = file.read(file.length() - file.pos());
 		break;
 	}
+	return mdat;
+}
+
+void Mp4::replaceMdat(BufferedAtom *mdat) {
+	Atom *original_mdat = root->atomByName("mdat");
+	mdat->start = original_mdat->start;
+	root->replace(original_mdat, mdat);
+}
+
+void Mp4::repair(string filename) {
+	char index[1024];
+	segment_index_path(filename.c_str(), index, sizeof(index));
+	File journal;
+	if(journal.open(index)) {
+		repairFromIndex(filename, index);
+		return;
+	}
+
+	BufferedAtom *mdat = findMdat(filename);
 
 	for(unsigned int i = 0; i < tracks.size(); i++)
 		tracks[i].clear();
@@ -401,9 +419,69 @@ void Mp4::repair(string filename) {
 	for(unsigned int i = 0; i < tracks.size(); i++)
 		tracks[i].fixTimes();
 
-	Atom *original_mdat = root->atomByName("mdat");
-	mdat->start = original_mdat->start;
-	root->replace(original_mdat, mdat);
+	replaceMdat(mdat);
 	//original_mdat->content.swap(mdat->content);
 	//original_mdat->start = -8;
 }
+
+void Mp4::repairFromIndex(string filename, string index) {
+	SegmentIndexHeader header;
+	FILE *journal = segment_index_open(index.c_str(), &header);
+	if(!journal)
+		throw "Could not open sample journal: " + index;
+	AVRational journal_base = { header.time_base_num, header.time_base_den };
+	segment_index_header_free(&header);
+
+	BufferedAtom *mdat;
+	try {
+		mdat = findMdat(filename);
+	} catch(...) {
+		fclose(journal);
+		throw;
+	}
+	//the encoder writes a single video track
+	Track *video = NULL;
+	for(unsigned int i = 0; i < tracks.size(); i++) {
+		tracks[i].clear();
+		if(!video && tracks[i].codec.name == "avc1")
+			video = &tracks[i];
+	}
+	if(!video)
+		video = &tracks[0];
+	AVRational track_base = { 1, video->timescale };
+
+	//samples still in the muxer buffer when the recording stopped are listed but not on the disk
+	int64_t available = mdat->file.length() - mdat->file_begin;
+	int64_t end = 0;
+	int64_t last_pts = -1;
+	SegmentIndexRecord record;
+	video->times.clear();
+	while(segment_index_read(journal, &record)) {
+		int64_t offset = record.offset - mdat->file_begin;
+		if(record.size <= 0 || offset < end || offset + record.size > available)
+			break;
+		if(last_pts >= 0)
+			video->times.push_back((int)av_rescale_q(record.pts - last_pts, journal_base, track_base));
+		last_pts = record.pts;
+		if(record.keyframe)
+			video->keyframes.push_back(video->offsets.size());
+		video->offsets.push_back((int)offset);
+		video->sizes.push_back(record.size);
+		end = offset + record.size;
+	}
+	fclose(journal);
+	if(video->offsets.empty())
+		throw string("No sample of the journal is in the file: ") + filename;
+	//the last sample lasts as long as the one before
+	video->times.push_back(video->times.empty() ? 1 : video->times.back());
+
+	cout << "Found " << video->offsets.size() << " packets in the journal\n";
+
+	mdat->file_end = mdat->file_begin + end;
+	mdat->length = mdat->file_end - mdat->file_begin;
+
+	for(unsigned int i = 0; i < tracks.size(); i++)
+		tracks[i].fixTimes();
+
+	replaceMdat(mdat);
+}
@@ -27,6 +27,7 @@
 
 #include "track.h"
 class Atom;
+class BufferedAtom;
 class File;
 class AVFormatContext;
 
@@ -50,12 +51,16 @@ public:
     void analyze();
     void writeTracksToAtoms();
     void repair(std::string filename);
+    //rebuilds the sample table from the journal written by the encoder, see segment_index.h
+    void repairFromIndex(std::string filename, std::string index);
 
 protected:    
     std::vector<Track> tracks;
     AVFormatContext *context;
 
     void parseTracks();
+    BufferedAtom *findMdat(std::string filename);
+    void replaceMdat(BufferedAtom *mdat);
 };
 
 
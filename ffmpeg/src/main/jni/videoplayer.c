@@ -3,6 +3,8 @@
 const enum AVPixelFormat TARGET_IMAGE_FORMAT = AV_PIX_FMT_RGBA; //AV_PIX_FMT_RGB24;
 const enum AVCodecID TARGET_IMAGE_CODEC = AV_CODEC_ID_PNG;
 
+#define PICTURE_ALIGN 32
+
 void createVideoEngine(VideoPlayer **ps) {
     VideoPlayer *is = *ps;
 }
@@ -35,33 +37,65 @@ void *createBmp(VideoPlayer **ps, int width, int height) {
 
     Picture *bmp = malloc(sizeof(Picture));
     bmp->buffer = NULL;
+    bmp->linesize = 0;
+    bmp->width = 0;
+    bmp->height = 0;
+    bmp->rotation = 0;
     return bmp;
 }
 
+void releaseBmpBuffer(void *bmp) {
+    Picture *picture = (Picture *) bmp;
+
+    if (picture && picture->buffer) {
+//        LOGI("Releasing frame buffer %p", picture->buffer);
+        av_freep(&picture->buffer);
+        picture->width = 0;
+        picture->height = 0;
+    }
+}
+
 void destroyBmp(void *bmp) {
 //    LOGI("Video Bitmap destroyed");
     Picture *picture = (Picture *) bmp;
 
     if (picture) {
-        if (picture->buffer) {
-//            LOGI("Releasing frame buffer %p", picture->buffer);
-            av_free(picture->buffer);
-            picture->buffer = NULL;
-        }
-
+        releaseBmpBuffer(picture);
         free(picture);
         picture = NULL;
     }
 }
 
+/*
+ * The rgba buffer of the picture is kept from frame to frame and only allocated again when the size
+ * changes, rows aligned for the scaler.
+ */
+static int ensureBuffer(Picture *picture, int width, int height) {
+    if (picture->buffer && picture->width == width && picture->height == height) {
+        return 0;
+    }
+    releaseBmpBuffer(picture);
+    int numBytes = av_image_get_buffer_size(TARGET_IMAGE_FORMAT, width, height, PICTURE_ALIGN);
+    if (numBytes < 0) {
+        return numBytes;
+    }
+    picture->buffer = av_malloc((size_t) numBytes);
+//    LOGI("Allocating frame buffer %p", picture->buffer);
+    if (!picture->buffer) {
+        return AVERROR(ENOMEM);
+    }
+    picture->width = width;
+    picture->height = height;
+    return 0;
+}
+
 void updateBmp(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *pCodecCtx, void *bmp, AVFrame *pFrame, int width, int height) {
     VideoPlayer *is = *ps;
 
     Picture *picture = (Picture *) bmp;
 
-    AVFrame *frame;
-
-    int got_packet_ptr = 0;
+    uint8_t *data[4];
+    int linesize[4];
 
     if (width == -1) {
         width = pCodecCtx->width;
@@ -71,48 +105,55 @@ void updateBmp(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *pCo
         height = pCodecCtx->height;
     }
 
-    frame = av_frame_alloc();
-
-    if (!frame) {
-        goto fail;
-    }
-
-    // Determine required buffer size and allocate buffer
-    int numBytes = av_image_get_buffer_size(TARGET_IMAGE_FORMAT, width, height, 1);
-    picture->buffer = (uint8_t *) av_malloc(numBytes * sizeof(uint8_t));
-
-//    LOGI("Allocating frame buffer %p", picture->buffer);
-
-
-    if (!picture->buffer) {
+    if (ensureBuffer(picture, width, height) < 0) {
         LOGI("updateBmp: no buffer allocated");
         return;
     }
-    // set the frame parameters
-    frame->format = TARGET_IMAGE_FORMAT;
-    frame->width = width;
-    frame->height = height;
 
-    av_image_fill_arrays(frame->data, frame->linesize,
+    av_image_fill_arrays(data, linesize,
                    picture->buffer,
                    TARGET_IMAGE_FORMAT,
                    width,
-                   height, 1);
+                   height, PICTURE_ALIGN);
 
     sws_scale(sws_ctx,
               (const uint8_t *const *) pFrame->data,
               pFrame->linesize,
               0,
               height,//todo swscale to surface resolution only
-              frame->data,
-              frame->linesize);
+              data,
+              linesize);
 
 
-    picture->linesize = frame->linesize[0];
+    picture->linesize = linesize[0];
+}
 
-    // TODO is this right?
-    fail:
-    av_free(frame);
+/* Copies an rgba picture into the window buffer, turned clockwise by rotation degrees. */
+static void copy_rotated(Picture *picture, int width, int height, uint32_t *dst, int dst_stride) {
+    int x, y;
+    for (y = 0; y < height; y++) {
+        const uint32_t *src = (const uint32_t *) ((uint8_t *) picture->buffer + y * picture->linesize);
+        switch (picture->rotation) {
+            case 90:
+                for (x = 0; x < width; x++) {
+                    dst[x * dst_stride + (height - 1 - y)] = src[x];
+                }
+                break;
+            case 180:
+                for (x = 0; x < width; x++) {
+                    dst[(height - 1 - y) * dst_stride + (width - 1 - x)] = src[x];
+                }
+                break;
+            case 270:
+                for (x = 0; x < width; x++) {
+                    dst[(width - 1 - x) * dst_stride + y] = src[x];
+                }
+                break;
+            default:
+                memcpy(dst + y * dst_stride, src, (size_t) (width * 4));
+                break;
+        }
+    }
 }
 
 void displayBmp(VideoPlayer **ps, void *bmp, AVCodecContext *pCodecCtx, int width, int height) {
@@ -132,16 +173,23 @@ void displayBmp(VideoPlayer **ps, void *bmp, AVCodecContext *pCodecCtx, int widt
     }
 
     if (is->native_window && *is->native_window) {
-        ANativeWindow_setBuffersGeometry((ANativeWindow *) *is->native_window, width, height, WINDOW_FORMAT_RGBA_8888);
+        // the window transform can not be used below api 26, the pixels are turned while copied
+        int quarter = picture->rotation == 90 || picture->rotation == 270;
+        ANativeWindow_setBuffersGeometry((ANativeWindow *) *is->native_window, quarter ? height : width, quarter ? width : height,
+                                         WINDOW_FORMAT_RGBA_8888);
 
         ANativeWindow_Buffer windowBuffer;
 
         if (ANativeWindow_lock((ANativeWindow *) *is->native_window, &windowBuffer, NULL) == 0) {
             int h = 0;
 
-            for (h = 0; h < height; h++) {
-                memcpy(windowBuffer.bits + h * windowBuffer.stride * 4,
-                       picture->buffer + h * picture->linesize, (size_t) (width * 4));
+            if (picture->rotation) {
+                copy_rotated(picture, width, height, (uint32_t *) windowBuffer.bits, windowBuffer.stride);
+            } else {
+                for (h = 0; h < height; h++) {
+                    memcpy(windowBuffer.bits + h * windowBuffer.stride * 4,
+                           picture->buffer + h * picture->linesize, (size_t) (width * 4));
+                }
             }
 
             ANativeWindow_unlockAndPost((ANativeWindow *) *is->native_window);
@@ -21,6 +21,8 @@ void createScreen(VideoPlayer **ps, size_t *surface);
 struct SwsContext *createScaler(VideoPlayer **ps, AVCodecContext *codec);
 void *createBmp(VideoPlayer **ps, int width, int height);
 void destroyBmp(void *bmp);
+/* Frees the rgba buffer of a picture that will not be shown for a while, updateBmp allocates it again. */
+void releaseBmpBuffer(void *bmp);
 void updateBmp(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *pCodecCtx, void *bmp, AVFrame *pFrame, int width, int height);
 void displayBmp(VideoPlayer **ps, void *bmp, AVCodecContext *pCodecCtx, int width, int height);
 void shutdownVideoEngine(VideoPlayer **ps);
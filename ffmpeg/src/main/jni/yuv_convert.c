@@ -0,0 +1,323 @@
+#include "yuv_convert.h"
+
+#include <string.h>
+
+#include "libavutil/error.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_SSE2 1
+#endif
+
+void yuv_copy_plane(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    int row;
+    if (src_stride == width && dst_stride == width) {
+        memcpy(dst, src, (size_t) width * height);
+        return;
+    }
+    for (row = 0; row < height; row++) {
+        memcpy(dst, src, (size_t) width);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void deinterleave_row(const uint8_t *src, uint8_t *a, uint8_t *b, int width) {
+    int i = 0;
+#if defined(YUV_NEON)
+    for (; i + 16 <= width; i += 16) {
+        uint8x16x2_t ab = vld2q_u8(src + 2 * i);
+        vst1q_u8(a + i, ab.val[0]);
+        vst1q_u8(b + i, ab.val[1]);
+    }
+#elif defined(YUV_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    for (; i + 16 <= width; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + 2 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + 2 * i + 16));
+        // even bytes are the low half of every 16 bit word, odd bytes the high half
+        __m128i even = _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i *) (a + i), even);
+        _mm_storeu_si128((__m128i *) (b + i), odd);
+    }
+#endif
+    for (; i < width; i++) {
+        a[i] = src[2 * i];
+        b[i] = src[2 * i + 1];
+    }
+}
+
+void yuv_deinterleave_plane(const uint8_t *src, int src_stride, uint8_t *dst_a, int a_stride, uint8_t *dst_b, int b_stride,
+                            int width, int height) {
+    int row;
+    for (row = 0; row < height; row++) {
+        deinterleave_row(src, dst_a, dst_b, width);
+        src += src_stride;
+        dst_a += a_stride;
+        dst_b += b_stride;
+    }
+}
+
+static void extract_even_row(const uint8_t *src, uint8_t *dst, int width) {
+    int i = 0;
+#if defined(YUV_NEON)
+    // the last pair of a row can be cut short at the end of the plane, keep the vector loads inside it
+    for (; i + 16 < width; i += 16) {
+        uint8x16x2_t ab = vld2q_u8(src + 2 * i);
+        vst1q_u8(dst + i, ab.val[0]);
+    }
+#elif defined(YUV_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    for (; i + 16 < width; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + 2 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + 2 * i + 16));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+    }
+#endif
+    for (; i < width; i++) {
+        dst[i] = src[2 * i];
+    }
+}
+
+void yuv_extract_plane(const uint8_t *src, int src_stride, int pixel_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    int row, i;
+    if (pixel_stride == 1) {
+        yuv_copy_plane(src, src_stride, dst, dst_stride, width, height);
+        return;
+    }
+    for (row = 0; row < height; row++) {
+        if (pixel_stride == 2) {
+            extract_even_row(src, dst, width);
+        } else {
+            for (i = 0; i < width; i++) {
+                dst[i] = src[i * pixel_stride];
+            }
+        }
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+int yuv_nv21_to_frame(AVFrame *frame, const uint8_t *y, int y_stride, const uint8_t *vu, int vu_stride) {
+    int chroma_width = (frame->width + 1) >> 1;
+    int chroma_height = (frame->height + 1) >> 1;
+    if (!frame->data[0] || !y || !vu) {
+        return -1;
+    }
+    yuv_copy_plane(y, y_stride, frame->data[0], frame->linesize[0], frame->width, frame->height);
+    yuv_deinterleave_plane(vu, vu_stride, frame->data[2], frame->linesize[2], frame->data[1], frame->linesize[1],
+                           chroma_width, chroma_height);
+    return 0;
+}
+
+int yuv_420_888_to_frame(AVFrame *frame, const uint8_t *y, int y_row_stride, const uint8_t *u, const uint8_t *v,
+                         int uv_row_stride, int uv_pixel_stride) {
+    int chroma_width = (frame->width + 1) >> 1;
+    int chroma_height = (frame->height + 1) >> 1;
+    if (!frame->data[0] || !y || !u || !v || uv_pixel_stride < 1) {
+        return -1;
+    }
+    yuv_copy_plane(y, y_row_stride, frame->data[0], frame->linesize[0], frame->width, frame->height);
+    if (uv_pixel_stride == 2 && v == u + 1) {
+        // NV12 in disguise
+        yuv_deinterleave_plane(u, uv_row_stride, frame->data[1], frame->linesize[1], frame->data[2], frame->linesize[2],
+                               chroma_width, chroma_height);
+    } else if (uv_pixel_stride == 2 && u == v + 1) {
+        // NV21 in disguise, what most camera HALs produce
+        yuv_deinterleave_plane(v, uv_row_stride, frame->data[2], frame->linesize[2], frame->data[1], frame->linesize[1],
+                               chroma_width, chroma_height);
+    } else {
+        yuv_extract_plane(u, uv_row_stride, uv_pixel_stride, frame->data[1], frame->linesize[1], chroma_width, chroma_height);
+        yuv_extract_plane(v, uv_row_stride, uv_pixel_stride, frame->data[2], frame->linesize[2], chroma_width, chroma_height);
+    }
+    return 0;
+}
+
+static void average_rows(const uint8_t *a, const uint8_t *b, uint8_t *dst, int width) {
+    int i = 0;
+#if defined(YUV_NEON)
+    for (; i + 16 <= width; i += 16) {
+        vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#elif defined(YUV_SSE2)
+    for (; i + 16 <= width; i += 16) {
+        __m128i avg = _mm_avg_epu8(_mm_loadu_si128((const __m128i *) (a + i)), _mm_loadu_si128((const __m128i *) (b + i)));
+        _mm_storeu_si128((__m128i *) (dst + i), avg);
+    }
+#endif
+    for (; i < width; i++) {
+        dst[i] = (uint8_t) ((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+void yuv_downsample_plane_v(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    int row;
+    for (row = 0; row + 1 < height; row += 2) {
+        average_rows(src, src + src_stride, dst, width);
+        src += 2 * src_stride;
+        dst += dst_stride;
+    }
+    if (height & 1) {
+        memcpy(dst, src, (size_t) width);
+    }
+}
+
+/* dst gets width / 2 samples, a and b have width samples. */
+static void average_blocks(const uint8_t *a, const uint8_t *b, uint8_t *dst, int width) {
+    int i = 0;
+#if defined(YUV_NEON)
+    for (; i + 16 <= width / 2; i += 16) {
+        uint16x8_t lo = vaddq_u16(vpaddlq_u8(vld1q_u8(a + 2 * i)), vpaddlq_u8(vld1q_u8(b + 2 * i)));
+        uint16x8_t hi = vaddq_u16(vpaddlq_u8(vld1q_u8(a + 2 * i + 16)), vpaddlq_u8(vld1q_u8(b + 2 * i + 16)));
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+#elif defined(YUV_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; i + 8 <= width / 2; i += 8) {
+        __m128i ra = _mm_loadu_si128((const __m128i *) (a + 2 * i));
+        __m128i rb = _mm_loadu_si128((const __m128i *) (b + 2 * i));
+        // sums of the even and odd bytes of both rows, in 16 bits
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(ra, mask), _mm_srli_epi16(ra, 8)),
+                                    _mm_add_epi16(_mm_and_si128(rb, mask), _mm_srli_epi16(rb, 8)));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64((__m128i *) (dst + i), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    for (; i < width / 2; i++) {
+        dst[i] = (uint8_t) ((a[2 * i] + a[2 * i + 1] + b[2 * i] + b[2 * i + 1] + 2) >> 2);
+    }
+    if (width & 1) {
+        dst[i] = (uint8_t) ((a[2 * i] + b[2 * i] + 1) >> 1);
+    }
+}
+
+void yuv_downsample_plane_hv(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height) {
+    int row;
+    for (row = 0; row + 1 < height; row += 2) {
+        average_blocks(src, src + src_stride, dst, width);
+        src += 2 * src_stride;
+        dst += dst_stride;
+    }
+    if (height & 1) {
+        average_blocks(src, src, dst, width);
+    }
+}
+
+/*
+ * out = base + (((clip(in, lo, hi) - lo) * mul + bias) >> 8), every intermediate value fits in 16 bits
+ * so the vector loops and the scalar one give the same result.
+ */
+typedef struct RangeMap {
+    uint8_t lo, hi, base;
+    uint16_t mul, bias;
+} RangeMap;
+
+static const RangeMap range_maps[2][2] = {
+        // to limited: luma, chroma
+        {{0, 255, 16, 220, 128}, {0, 255, 16, 225, 64}},
+        // to full: luma, chroma
+        {{16, 235, 0, 298, 128}, {16, 240, 0, 291, 176}},
+};
+
+static void range_row(const uint8_t *src, uint8_t *dst, int width, const RangeMap *m) {
+    int i = 0;
+#if defined(YUV_NEON)
+    const uint8x16_t lo = vdupq_n_u8(m->lo), hi = vdupq_n_u8(m->hi), base = vdupq_n_u8(m->base);
+    const uint16x8_t bias = vdupq_n_u16(m->bias);
+    for (; i + 16 <= width; i += 16) {
+        uint8x16_t v = vsubq_u8(vminq_u8(vmaxq_u8(vld1q_u8(src + i), lo), hi), lo);
+        uint16x8_t l = vmlaq_n_u16(bias, vmovl_u8(vget_low_u8(v)), m->mul);
+        uint16x8_t h = vmlaq_n_u16(bias, vmovl_u8(vget_high_u8(v)), m->mul);
+        vst1q_u8(dst + i, vaddq_u8(vcombine_u8(vshrn_n_u16(l, 8), vshrn_n_u16(h, 8)), base));
+    }
+#elif defined(YUV_SSE2)
+    const __m128i lo = _mm_set1_epi8((char) m->lo), hi = _mm_set1_epi8((char) m->hi), base = _mm_set1_epi8((char) m->base);
+    const __m128i mul = _mm_set1_epi16((short) m->mul), bias = _mm_set1_epi16((short) m->bias);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= width; i += 16) {
+        __m128i v = _mm_subs_epu8(_mm_min_epu8(_mm_max_epu8(_mm_loadu_si128((const __m128i *) (src + i)), lo), hi), lo);
+        // the products fit in 16 bits, so the low half of the signed multiplication is the unsigned result
+        __m128i l = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), mul), bias), 8);
+        __m128i h = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), mul), bias), 8);
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi8(_mm_packus_epi16(l, h), base));
+    }
+#endif
+    for (; i < width; i++) {
+        int v = src[i] < m->lo ? m->lo : src[i] > m->hi ? m->hi : src[i];
+        dst[i] = (uint8_t) (m->base + (((v - m->lo) * m->mul + m->bias) >> 8));
+    }
+}
+
+void yuv_range_plane(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height,
+                     int to_full, int chroma) {
+    const RangeMap *m = &range_maps[!!to_full][!!chroma];
+    int row;
+    for (row = 0; row < height; row++) {
+        range_row(src, dst, width, m);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static int is_full_range(const AVFrame *frame) {
+    switch (frame->format) {
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUVJ422P:
+        case AV_PIX_FMT_YUVJ444P:
+            return 1;
+        default:
+            return frame->color_range == AVCOL_RANGE_JPEG;
+    }
+}
+
+int yuv_frame_to_420(const AVFrame *src, AVFrame *dst) {
+    int chroma_width = (src->width + 1) >> 1;
+    int chroma_height = (src->height + 1) >> 1;
+    int i;
+    if (dst->format != AV_PIX_FMT_YUV420P && dst->format != AV_PIX_FMT_YUVJ420P) {
+        return AVERROR(ENOSYS);
+    }
+    if (src->width != dst->width || src->height != dst->height || !dst->data[0]) {
+        return AVERROR(EINVAL);
+    }
+    int to_full = dst->format == AV_PIX_FMT_YUVJ420P;
+    int convert_range = is_full_range(src) != to_full;
+    for (i = 1; i < 3; i++) {
+        switch (src->format) {
+            case AV_PIX_FMT_YUV420P:
+            case AV_PIX_FMT_YUVJ420P:
+                if (!convert_range) {
+                    yuv_copy_plane(src->data[i], src->linesize[i], dst->data[i], dst->linesize[i], chroma_width, chroma_height);
+                    continue;
+                }
+                // converted straight from the source below
+                break;
+            case AV_PIX_FMT_YUV422P:
+            case AV_PIX_FMT_YUVJ422P:
+                yuv_downsample_plane_v(src->data[i], src->linesize[i], dst->data[i], dst->linesize[i], chroma_width, src->height);
+                break;
+            case AV_PIX_FMT_YUV444P:
+            case AV_PIX_FMT_YUVJ444P:
+                yuv_downsample_plane_hv(src->data[i], src->linesize[i], dst->data[i], dst->linesize[i], src->width, src->height);
+                break;
+            default:
+                return AVERROR(ENOSYS);
+        }
+        if (convert_range) {
+            int in_place = src->format != AV_PIX_FMT_YUV420P && src->format != AV_PIX_FMT_YUVJ420P;
+            yuv_range_plane(in_place ? dst->data[i] : src->data[i], in_place ? dst->linesize[i] : src->linesize[i],
+                            dst->data[i], dst->linesize[i], chroma_width, chroma_height, to_full, 1);
+        }
+    }
+    if (convert_range) {
+        yuv_range_plane(src->data[0], src->linesize[0], dst->data[0], dst->linesize[0], src->width, src->height, to_full, 0);
+    } else {
+        yuv_copy_plane(src->data[0], src->linesize[0], dst->data[0], dst->linesize[0], src->width, src->height);
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef YUV_CONVERT_H_
+#define YUV_CONVERT_H_
+
+#include <stdint.h>
+#include "libavutil/frame.h"
+
+/*
+ * Conversion of raw camera frames and decoded jpegs into the planar yuv 4:2:0 layout the h264 encoder takes.
+ * The row loops use NEON or SSE2 when the target has them, with a scalar fallback for the
+ * remainder of the row and for other targets.
+ */
+
+void yuv_copy_plane(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/* Splits a plane of interleaved byte pairs, width is the number of pairs per row. */
+void yuv_deinterleave_plane(const uint8_t *src, int src_stride, uint8_t *dst_a, int a_stride, uint8_t *dst_b, int b_stride,
+                            int width, int height);
+
+/* Copies every pixel_stride'th byte of a plane. */
+void yuv_extract_plane(const uint8_t *src, int src_stride, int pixel_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/*
+ * Fills a YUV420P frame, whose width, height and buffers are already set, from an NV21 image
+ * (Camera.PreviewCallback) with a full resolution y plane followed by interleaved v/u samples.
+ */
+int yuv_nv21_to_frame(AVFrame *frame, const uint8_t *y, int y_stride, const uint8_t *vu, int vu_stride);
+
+/*
+ * Same as above for the three planes of an android.media.Image in the YUV_420_888 format.
+ * The u and v planes share the row and pixel strides; a pixel stride of 2 means they are the
+ * two halves of one interleaved plane, which is deinterleaved in a single pass.
+ */
+int yuv_420_888_to_frame(AVFrame *frame, const uint8_t *y, int y_row_stride, const uint8_t *u, const uint8_t *v,
+                         int uv_row_stride, int uv_pixel_stride);
+
+/* Halves the height of a plane, averaging pairs of rows. width and height are the source's. */
+void yuv_downsample_plane_v(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/* Halves both dimensions of a plane, averaging blocks of 2x2 samples. width and height are the source's. */
+void yuv_downsample_plane_hv(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/*
+ * Maps a plane between the full (jpeg, 0-255) and the limited (16-235 luma, 16-240 chroma) ranges,
+ * src and dst may be the same plane.
+ */
+void yuv_range_plane(const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int width, int height,
+                     int to_full, int chroma);
+
+/*
+ * Fills a YUV420P or YUVJ420P frame of the same size, whose buffers are already set, from a planar
+ * 4:2:0, 4:2:2 or 4:4:4 frame, converting the range when the formats differ. Returns AVERROR(ENOSYS)
+ * for the other formats, which are left to swscale.
+ */
+int yuv_frame_to_420(const AVFrame *src, AVFrame *dst);
+
+#endif /* YUV_CONVERT_H_ */